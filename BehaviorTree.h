@@ -2,8 +2,23 @@
 #define BEHAVIORTREE_BEHAVIORTREE_H
 
 #include <vector>
+#include <algorithm>
 #include <exception>
+#include <stdexcept>
+#include <iostream>
 #include <string>
+#include <cstdint>
+#include <unordered_map>
+#include <queue>
+#include <atomic>
+#include <functional>
+#include <any>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <cmath>
+#include <chrono>
+#include <condition_variable>
 
 /**
  * Simple Behavior Tree base implementation
@@ -11,16 +26,59 @@
  *
  * Enums:
  * - NodeState
+ * - GroupMode
+ * - BatchSchedule
+ *
+ * Time:
+ * - Clock
+ * - SteadyClock
+ * - SimulatedClock
+ *
+ * Batch mode:
+ * - LaneBlock
+ * - StatePlanes
+ * - Wavefront
+ * - Population
+ * - mortonKey
  *
  * Classes:
  * - Node
  * - BehaviorTree
+ * - EventChannel
+ * - EventBus
  * - ISelectorBranch
+ * - Blackboard
+ * - IObserverSelector
  * - ISequenceBranch
+ * - ISwitchBranch
+ * - IDecisionTable
+ * - DecisionRule
+ * - IStateMachine
+ * - WorldCondition
+ * - IPlannerAction
+ * - TreeSnapshot
+ * - ILookahead
  * - IActionLeaf
  * - IConditionLeaf
+ * - ConditionGroup
+ * - FieldCompare
+ * - FieldRange
+ * - FieldAll
+ * - IParalellSequence
+ * - IParallel
  * - IDecorator
  * - Inverter (decorator)
+ * - Cooldown (decorator)
+ * - Timeout (decorator)
+ * - Wait
+ * - SubtreeRef
+ * - SubtreeLibrary
+ * - OnEvent
+ * - SharedGroup
+ * - ISharedEvaluation
+ * - IEquivalenceClasses
+ * - SpatialQuery
+ * - SpatialQueryCache
  */
 namespace BHT
 {
@@ -31,6 +89,163 @@ namespace BHT
         FAILURE
     };
 
+    /**
+     * Time source of time based nodes and tools. Times are durations since an arbitrary epoch of the clock.
+     */
+    class Clock
+    {
+    public:
+        typedef std::chrono::nanoseconds Duration;
+
+        virtual ~Clock() = default;
+
+        virtual Duration now() const = 0;
+    };
+
+    /**
+     * Wall clock time of std::chrono::steady_clock
+     */
+    class SteadyClock : public Clock
+    {
+    public:
+        Duration now() const override
+        {
+            return std::chrono::duration_cast<Duration>(std::chrono::steady_clock::now().time_since_epoch());
+        }
+    };
+
+    /**
+     * Simulated time, which only moves when advanced. Runs days of timers in seconds with reproducible results.
+     * Not thread safe: advance between ticks, while no node reads the clock.
+     */
+    class SimulatedClock : public Clock
+    {
+    public:
+        /**
+         * @param step Time step() advances by
+         * @param start Initial time
+         */
+        explicit SimulatedClock(Duration step = Duration(0), Duration start = Duration(0)) : _now(start), _step(step)
+        {}
+
+        Duration now() const override { return _now; }
+
+        /**
+         * Advances the time by the fixed step, e.g. once per tick
+         */
+        void step() { _now += _step; }
+
+        /**
+         * Advances the time by a duration
+         */
+        void advance(Duration duration) { _now += duration; }
+
+    private:
+        Duration _now;
+        Duration _step;
+    };
+
+
+    /**
+     * One bit per agent of a LaneBlock
+     */
+    typedef std::uint64_t LaneMask;
+
+    /**
+     * @return Index of the lowest set lane, mask must not be empty
+     */
+    inline unsigned _lowest_lane(LaneMask mask)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return unsigned(__builtin_ctzll(mask));
+#else
+        unsigned lane = 0;
+        while ((mask & 1) == 0)
+        {
+            mask >>= 1;
+            lane++;
+        }
+        return lane;
+#endif
+    }
+
+    /**
+     * The states of a node for the lanes of a LaneBlock as two bit planes, two bits per agent instead of a NodeState.
+     *
+     * - Lanes in done and success are SUCCESS.
+     * - Lanes in done but not in success are FAILURE.
+     * - Evaluated lanes not in done are RUNNING.
+     *
+     * Only evaluated lanes may be set, so branches combine the states of their children with AND, OR and ANDNOT.
+     */
+    struct StatePlanes
+    {
+        LaneMask done;    // Lanes that finished
+        LaneMask success; // Lanes that finished with SUCCESS, subset of done
+
+        LaneMask failure() const { return done & ~success; }
+
+        LaneMask running(LaneMask evaluated) const { return evaluated & ~done; }
+
+        /**
+         * Record the state of a single lane
+         */
+        void set(unsigned lane, NodeState state)
+        {
+            const LaneMask bit = LaneMask(1) << lane;
+            if (state != NodeState::RUNNING) done |= bit;
+            if (state == NodeState::SUCCESS) success |= bit;
+        }
+
+        /**
+         * @return State of an evaluated lane
+         */
+        NodeState state(unsigned lane) const
+        {
+            if ((done >> lane & 1) == 0) return NodeState::RUNNING;
+            return (success >> lane & 1) != 0 ? NodeState::SUCCESS : NodeState::FAILURE;
+        }
+    };
+
+    template<class T>
+    class Node;
+
+    /**
+     * Up to 64 agents sharing one tree that are evaluated together in batch mode, like the lanes of a GPU warp.
+     *
+     * @tparam T Data context class of behavior tree
+     */
+    template<class T>
+    struct LaneBlock
+    {
+        static constexpr std::size_t LANES = 64;
+
+        T* contexts[LANES];      // Context of the agent in each lane
+        Node<T>* running[LANES]; // Node each RUNNING lane is running in, set by the first node reporting it
+        std::size_t count = 0;   // Lanes in use
+        std::uint64_t tick = 0;  // Update the block belongs to, numbered by the Population
+
+        /**
+         * @return Mask of the lanes in use
+         */
+        LaneMask lanes() const
+        {
+            return count >= LANES ? ~LaneMask(0) : (LaneMask(1) << count) - 1;
+        }
+    };
+
+    /**
+     * Agents sharing one tree that are evaluated node by node in wavefront mode.
+     * Each node receives the list of all agents that reached it, identified by their index.
+     *
+     * @tparam T Data context class of behavior tree
+     */
+    template<class T>
+    struct Wavefront
+    {
+        T* const* contexts; // Context of every agent
+        Node<T>** running;  // Node each RUNNING agent is running in, set by the first node reporting it
+    };
 
     /**
      * Base class for any node in the behavior tree.
@@ -46,6 +261,7 @@ namespace BHT
         Node* parent;                // The parent node
         NodeState state;             // State of the evaluation
         std::vector<Node*> children; // List of child nodes
+        std::size_t index = 0;       // Position of the node's state in an agent's states, see eval(context, states)
         bool DEBUG = false;          // Print the evaluation if true
 
         /**
@@ -64,7 +280,7 @@ namespace BHT
         /**
          * Recursively destroys entire tree
          */
-        ~Node()
+        virtual ~Node()
         {
             // Iterate all child nodes and delete
             for (Node* node : children)
@@ -80,7 +296,15 @@ namespace BHT
          */
         void printState()
         {
-            switch (this->state)
+            printState(this->state);
+        }
+
+        /**
+         * Prints the given state together with the node's assigned name.
+         */
+        void printState(NodeState state)
+        {
+            switch (state)
             {
             case NodeState::SUCCESS:
                 std::cout << name << ": SUCCESS" << std::endl;
@@ -104,12 +328,112 @@ namespace BHT
             return this->state;
         }
 
+        /**
+         * Call to evaluate a node for an agent without binding the agent's context to the tree.
+         * The states of the agent are kept in its own array, indexed by the nodes' index.
+         * One tree can serve any number of agents this way, see BehaviorTree::Update(context, states).
+         *
+         * @param context The data context of the agent
+         * @param states The states of the agent, one per numbered node
+         */
+        NodeState eval(T* context, NodeState* states)
+        {
+            const NodeState state = _evaluate_instance(context, states);
+            states[index] = state;
+            if (this->DEBUG) printState(state);
+            return state;
+        }
+
         /**
          * A method to evaluate a node in the behavior tree. Must be implemented in interfaces.
          * @return The evaluation state of the node
          */
         virtual NodeState _evaluate() = 0;
 
+        /**
+         * Evaluates the node for an agent whose context and states are passed in, see eval(context, states).
+         * The default implementation binds the context to the subtree and evaluates it with _evaluate().
+         * Override in branches to evaluate children with eval(context, states),
+         * and in leaves to only bind the context to the leaf itself.
+         * @return The evaluation state of the node
+         */
+        virtual NodeState _evaluate_instance(T* context, NodeState* states)
+        {
+            (void)states;
+            this->context = context;
+            _propagate_context();
+            return _evaluate();
+        }
+
+        /**
+         * Evaluates the node for the active lanes of a batch block.
+         * The default implementation evaluates each active lane separately by binding its context to the subtree.
+         * Override in branches and leaves to combine lanes with bitwise operations instead.
+         *
+         * Node states are not updated in batch mode.
+         * @return The states of the active lanes
+         */
+        virtual StatePlanes _evaluate_lanes(LaneBlock<T>& block, LaneMask active)
+        {
+            StatePlanes result = {0, 0};
+            for (LaneMask lanes = active; lanes != 0; lanes &= lanes - 1)
+            {
+                const unsigned lane = _lowest_lane(lanes);
+                this->context = block.contexts[lane];
+                _propagate_context();
+                const NodeState state = eval();
+                result.set(lane, state);
+                if (state == NodeState::RUNNING && block.running[lane] == nullptr) block.running[lane] = _running_node();
+            }
+            return result;
+        }
+
+        /**
+         * Evaluates the node for all agents that reached it in wavefront mode.
+         * The default implementation evaluates each agent separately by binding its context to the subtree.
+         * Override in branches to pass each child the list of agents that reach it,
+         * and in leaves to process all agents at once.
+         *
+         * Node states are not updated in batch mode.
+         * @param wave The evaluated agents
+         * @param agents Indices of the agents that reached this node
+         * @param states Receives the state of each agent in agents
+         */
+        virtual void _evaluate_wave(Wavefront<T>& wave, const std::vector<std::size_t>& agents, NodeState* states)
+        {
+            for (std::size_t i = 0; i < agents.size(); i++)
+            {
+                this->context = wave.contexts[agents[i]];
+                _propagate_context();
+                states[i] = eval();
+                if (states[i] == NodeState::RUNNING && wave.running[agents[i]] == nullptr)
+                    wave.running[agents[i]] = _running_node();
+            }
+        }
+
+        /**
+         * @return The deepest node reached by following RUNNING children from this node
+         */
+        Node* _running_node()
+        {
+            Node* node = this;
+            bool descended = true;
+            while (descended)
+            {
+                descended = false;
+                for (Node* child : node->children)
+                {
+                    if (child->state == NodeState::RUNNING)
+                    {
+                        node = child;
+                        descended = true;
+                        break;
+                    }
+                }
+            }
+            return node;
+        }
+
         /**
          * Attach a child node.
          * @param node The node to attach
@@ -136,6 +460,78 @@ namespace BHT
                 node->_propagate_context();
             }
         }
+
+        /**
+         * Appends this node and its entire subtree to nodes in pre-order.
+         * Used to compile a tree into a flat list of nodes.
+         * @param nodes The list to append to
+         */
+        virtual void _collect(std::vector<Node*>& nodes)
+        {
+            nodes.push_back(this);
+            for (Node* node : children)
+            {
+                node->_collect(nodes);
+            }
+        }
+
+        /**
+         * Assigns the nodes of the subtree their index in an agent's states, in pre-order.
+         * @param next The next free index, advanced past the subtree
+         */
+        virtual void _number(std::size_t& next)
+        {
+            index = next++;
+            for (Node* node : children)
+            {
+                node->_number(next);
+            }
+        }
+
+        /**
+         * Interrupts a RUNNING node of an agent evaluated with eval(context, states).
+         * The default implementation halts the agent's running children and resets its state.
+         */
+        virtual void _halt_instance(T* context, NodeState* states)
+        {
+            for (Node* node : children)
+            {
+                if (states[node->index] == NodeState::RUNNING) node->_halt_instance(context, states);
+            }
+            states[index] = NodeState::FAILURE;
+        }
+
+        /**
+         * Interrupts a RUNNING node. Called by a parent that no longer needs the result of this node.
+         * The default implementation halts all running children and resets the state.
+         * Override in leaves that need to cancel ongoing work, and call the base implementation.
+         */
+        virtual void _halt()
+        {
+            for (Node* node : children)
+            {
+                if (node->state == NodeState::RUNNING) node->_halt();
+            }
+            this->state = NodeState::FAILURE;
+        }
+
+        /**
+         * Saves the runtime members the node keeps besides its context and state, see TreeSnapshot.
+         * Override together with _restore in nodes with such members, e.g. the running child or a timer.
+         * @return The saved members, empty if the node has none
+         */
+        virtual std::any _save() const
+        {
+            return std::any();
+        }
+
+        /**
+         * Restores the runtime members saved by _save
+         */
+        virtual void _restore(const std::any& saved)
+        {
+            (void)saved;
+        }
     };
 
 
@@ -161,7 +557,7 @@ namespace BHT
         {
             child = tree;
             this->context = context;
-            _propagate_context();
+            if (context != nullptr) _propagate_context();
         }
 
         ~Root()
@@ -186,246 +582,3846 @@ namespace BHT
     };
 
 
-    template<class T>
-    class BehaviorTree
+    /**
+     * Untyped interface of an event channel, used by the EventBus to deliver all channels at once.
+     */
+    class IEventChannel
     {
     public:
-        BehaviorTree(T* context, Node<T>* tree)
-        {
-            _root = new Root<T>(context, tree);
-        }
-
-        ~BehaviorTree()
-        {
-            delete this->root;
-        }
+        virtual ~IEventChannel() = default;
 
         /**
-         * Performs an iteration of the behavior tree
+         * Delivers the events published since the last delivery
          */
-        void Update()
-        {
-            _root->_evaluate();
-        }
-
-    private:
-        Root<T>* _root;
+        virtual void deliver() = 0;
     };
 
+    /**
+     * Receives events delivered by an EventChannel.
+     * @tparam E Event type
+     */
+    template<class E>
+    class IEventSubscriber
+    {
+    public:
+        virtual ~IEventSubscriber() = default;
+
+        /**
+         * Called once per delivered event, on the thread delivering the channel
+         */
+        virtual void notify(const E& event) = 0;
+    };
 
     /**
-     * Selector branches 'select' the first sub-branch (child node) that returns SUCCESS or RUNNING.
-     * The evaluation order is from left to right in the list of children the Selector holds.
-     *
-     * The nodes in the selector's children are iterated over and evaluated by calling evaluate.
-     * These child nodes can be other branches, decorators, or leaf nodes.
+     * A typed event channel. Events can be published from any thread without locking,
+     * and are delivered in batches to the subscribers on the thread that updates the tree.
      *
-     * - If a child node is evaluated to FAILURE the selector continues on to the next child node.
-     * - The selector returns on the first SUCCESS evaluation of a child with a SUCCESS state.
-     * - The selector returns on the first RUNNING evaluation of a child with a RUNNING state.
+     * Subscribing, unsubscribing and delivering must happen on the tree's thread.
      *
-     * @tparam T Data context class of behavior tree
+     * @tparam E Event type, must be copy constructible
      */
-    template<class T>
-    class ISelectorBranch : public Node<T>
+    template<class E>
+    class EventChannel : public IEventChannel
     {
     public:
+        EventChannel() = default;
+        EventChannel(const EventChannel&) = delete;
+        EventChannel& operator=(const EventChannel&) = delete;
+
+        ~EventChannel() override
+        {
+            Envelope* envelope = _pending.exchange(nullptr, std::memory_order_acquire);
+            while (envelope != nullptr)
+            {
+                Envelope* next = envelope->next;
+                delete envelope;
+                envelope = next;
+            }
+        }
+
         /**
-         * Attach the children to the node within the constructor using the _attach(child*) method
+         * Queues an event for the next delivery. Safe to call from any thread.
          */
-        explicit ISelectorBranch(std::string name = "") : Node<T>(nullptr, name)
-        {}
+        void publish(const E& event)
+        {
+            Envelope* envelope = new Envelope{event, _pending.load(std::memory_order_relaxed)};
+            while (!_pending.compare_exchange_weak(envelope->next, envelope, std::memory_order_release, std::memory_order_relaxed))
+            {}
+        }
 
-        NodeState _evaluate() override
+        /**
+         * Takes all queued events and notifies the subscribers of each in publishing order
+         */
+        void deliver() override
         {
-            for (Node<T>* child : this->children)
+            _batch++;
+            _delivered.clear();
+            Envelope* envelope = _pending.exchange(nullptr, std::memory_order_acquire);
+            if (envelope == nullptr) return;
+
+            // The queue is a stack, reverse it to restore publishing order
+            Envelope* ordered = nullptr;
+            while (envelope != nullptr)
             {
-                // Update state of child
-                child->eval();
-                switch (child->state)
+                Envelope* next = envelope->next;
+                envelope->next = ordered;
+                ordered = envelope;
+                envelope = next;
+            }
+            while (ordered != nullptr)
+            {
+                Envelope* next = ordered->next;
+                _delivered.push_back(std::move(ordered->event));
+                delete ordered;
+                ordered = next;
+            }
+
+            for (const E& event : _delivered)
+            {
+                for (IEventSubscriber<E>* subscriber : _subscribers)
                 {
-                    // Return first successful child branch
-                case NodeState::SUCCESS:
-                    return NodeState::SUCCESS;
-                    // Return first running child branch
-                case NodeState::RUNNING:
-                    return NodeState::RUNNING;
+                    subscriber->notify(event);
                 }
             }
-            // All sub-branches failed
-            return NodeState::FAILURE;
         }
-    };
 
+        void subscribe(IEventSubscriber<E>* subscriber)
+        {
+            _subscribers.push_back(subscriber);
+        }
 
-    /**
-     * A sequence tries to evaluate all it's children
-     *
-     * The nodes in the sequence's children are iterated over and evaluated by calling evaluate.
-     * These child nodes can be other branches, decorators, or leaf nodes.
-     *
-     * - If any of the nodes return a FAILURE state, the sequence is aborted and returns FAILURE.
-     * - If all nodes return a SUCCESS state, the sequence returns SUCCESS.
-     * - If a node returns RUNNING, the sequence stops and returns RUNNING.
-     *
-     * @tparam T Data context class of behavior tree
-     */
-    template<class T>
-    class ISequenceBranch : public Node<T> {
-    public:
-        /**
-         * Attach the children to the node within the constructor using the _attach(child*) method
-         */
-        explicit ISequenceBranch(std::string name = "") : Node<T>(nullptr, name)
-        {}
-
-        NodeState _evaluate() override
+        void unsubscribe(IEventSubscriber<E>* subscriber)
         {
-            // Iterate and evaluate all children
-            for (Node<T>* child : this->children)
+            for (std::size_t i = 0; i < _subscribers.size(); i++)
             {
-                // Assign new child state
-                child->eval();
-                // Stop iterating if the state isn't success
-                if (child->state != NodeState::SUCCESS)
+                if (_subscribers[i] == subscriber)
                 {
-                    return child->state;
+                    _subscribers[i] = _subscribers.back();
+                    _subscribers.pop_back();
+                    return;
                 }
             }
-            // All child nodes returned success
-            return NodeState::SUCCESS;
         }
+
+        /**
+         * @return The events of the last delivery
+         */
+        const std::vector<E>& delivered() const { return _delivered; }
+
+        /**
+         * @return Number of deliveries so far. Identifies the current batch.
+         */
+        std::uint64_t batch() const { return _batch; }
+
+    private:
+        struct Envelope
+        {
+            E event;
+            Envelope* next;
+        };
+
+        std::atomic<Envelope*> _pending{nullptr};
+        std::vector<E> _delivered;
+        std::vector<IEventSubscriber<E>*> _subscribers;
+        std::uint64_t _batch = 0;
     };
 
     /**
-     * Base class for condition leaves. Conditions do not have child nodes.
-     *
-     * Used to check whether a condition is true or false.
-     *
-     * They are similar to action leaves but should not alter the state of the system.
-     * Meaning a condition leaf is always synchronous and does not return a RUNNING state.
-     *
-     * Requires an implementation of the condition() method.
+     * Holds one EventChannel per event type.
+     * A BehaviorTree constructed with a bus delivers it at the start of every update, so give each tree its own bus.
      */
-    template<class T>
-    class IConditionLeaf : public Node<T>
+    class EventBus
     {
     public:
-        IConditionLeaf(std::string name = "") : Node<T>(nullptr, name){}
+        EventBus() = default;
+        EventBus(const EventBus&) = delete;
+        EventBus& operator=(const EventBus&) = delete;
 
-        NodeState _evaluate() override {
-            // Condition holds
-            if (condition()) 
-                return NodeState::SUCCESS;
-            // Condition does not hold (false)
-            return NodeState::FAILURE;
+        ~EventBus()
+        {
+            for (IEventChannel* channel : _channels)
+            {
+                delete channel;
+            }
         }
+
         /**
-         * This method describes whether the node's condition is met or not.
-         *
-         * If the method returns true, the state will be evaluated to SUCCESS.
-         * If the method returns false, the state will be evaluated to FAILURE.
-         * @return true when condition is met. False otherwise.
+         * @return The channel for events of type E, created on first use
          */
-        virtual bool condition() = 0;
+        template<class E>
+        EventChannel<E>& channel()
+        {
+            const std::size_t type = _type<E>();
+            if (type >= _channels.size()) _channels.resize(type + 1, nullptr);
+            if (_channels[type] == nullptr) _channels[type] = new EventChannel<E>();
+            return *static_cast<EventChannel<E>*>(_channels[type]);
+        }
+
+        /**
+         * Delivers all channels
+         */
+        void deliver()
+        {
+            for (IEventChannel* channel : _channels)
+            {
+                if (channel != nullptr) channel->deliver();
+            }
+        }
+
+    private:
+        std::vector<IEventChannel*> _channels; // Indexed by event type id
+
+        static std::size_t _next_type()
+        {
+            static std::atomic<std::size_t> next{0};
+            return next++;
+        }
+
+        template<class E>
+        static std::size_t _type()
+        {
+            static const std::size_t type = _next_type();
+            return type;
+        }
     };
 
-    /**
-     * Base class for action leaves. Actions do not have child nodes.
-     *
-     * An action leaf performs a task.
-     * The action can return in a SUCCESS, FAILURE or RUNNING state.
-     * @tparam T Data context class of behavior tree
-     */
+
     template<class T>
-    class IActionLeaf : public Node<T>
+    class BehaviorTree
     {
     public:
-        IActionLeaf(std::string name = ""): Node<T> (nullptr, name) {}
+        /**
+         * @param context The data context
+         * @param tree The tree to evaluate. The behavior tree takes ownership.
+         * @param events Optional event bus delivered at the start of every update. Not owned.
+         */
+        BehaviorTree(T* context, Node<T>* tree, EventBus* events = nullptr)
+        {
+            tree->_number(_size);
+            _root = new Root<T>(context, tree);
+            _events = events;
+        }
 
-        NodeState _evaluate() override {
-            return action();
+        /**
+         * Construct a tree without a bound context, to be evaluated with Update(context, states)
+         * @param tree The tree to evaluate. The behavior tree takes ownership.
+         * @param events Optional event bus delivered by deliver(), once per tick. Not owned.
+         */
+        explicit BehaviorTree(Node<T>* tree, EventBus* events = nullptr) : BehaviorTree(nullptr, tree, events)
+        {}
+
+        ~BehaviorTree()
+        {
+            delete this->_root;
         }
 
         /**
-         * The task of the action node
-         * @return The state of the action at the time of returning
+         * Performs an iteration of the behavior tree.
+         * Events published since the last update are delivered first.
          */
-        virtual NodeState action() = 0;
+        void Update()
+        {
+            if (_events != nullptr) _events->deliver();
+            _root->_evaluate();
+        }
+
+        /**
+         * Delivers the events published since the last delivery.
+         * Call once per tick before Update(context, states) for the agents, which does not deliver events itself
+         * so that all agents of the tick see the same delivery.
+         */
+        void deliver()
+        {
+            if (_events != nullptr) _events->deliver();
+        }
+
+        /**
+         * Performs an iteration of the behavior tree for an agent without binding its context to the tree.
+         * Switching between agents costs nothing, each agent only needs its own states.
+         * Stateful nodes (e.g. IStateMachine) keep one runtime state for all agents and need a tree per agent.
+         *
+         * @param context The data context of the agent
+         * @param states The states of the agent, size() elements initialized to FAILURE
+         * @return The state of the tree for the agent
+         */
+        NodeState Update(T* context, NodeState* states)
+        {
+            return _root->child->eval(context, states);
+        }
+
+        /**
+         * @return Number of states an agent needs for Update(context, states)
+         */
+        std::size_t size() const { return _size; }
+
+    private:
+        Root<T>* _root;
+        EventBus* _events;
+        std::size_t _size = 0; // Numbered nodes
     };
 
+
     /**
-     * All child nodes are evaluated until a FAILURE evaluation
-     * Evaluates to SUCCESS if all children retrun success
-     * Evaluates to RUNNING if any of the children returns running
-     * Evaluates to FAILURE if any of the nodes return failure
+     * Selector branches 'select' the first sub-branch (child node) that returns SUCCESS or RUNNING.
+     * The evaluation order is from left to right in the list of children the Selector holds.
+     *
+     * The nodes in the selector's children are iterated over and evaluated by calling evaluate.
+     * These child nodes can be other branches, decorators, or leaf nodes.
+     *
+     * - If a child node is evaluated to FAILURE the selector continues on to the next child node.
+     * - The selector returns on the first SUCCESS evaluation of a child with a SUCCESS state.
+     * - The selector returns on the first RUNNING evaluation of a child with a RUNNING state.
+     *
+     * @tparam T Data context class of behavior tree
      */
     template<class T>
-    class IParalellSequence : public Node<T>
+    class ISelectorBranch : public Node<T>
     {
     public:
         /**
-         * Attach the children to the node within this method. (Using _attach(child))
+         * Attach the children to the node within the constructor using the _attach(child*) method
          */
-        IParalellSequence(std::string name = "") : Node<T>(nullptr, name)
-        {};
+        explicit ISelectorBranch(std::string name = "") : Node<T>(nullptr, name)
+        {}
 
-        NodeState _evaluate() override {
-            bool allSuccess = true;
-            // Iterate and evaluate all children
+        NodeState _evaluate() override
+        {
             for (Node<T>* child : this->children)
             {
-                // Update child state
+                // Update state of child
                 child->eval();
-                // Stop iterating if the state is failure
-                if (child->state == NodeState::FAILURE) return child->state;
-                // Signal not finished if any node is running
-                if (child->state == NodeState::RUNNING) allSuccess = false;
+                switch (child->state)
+                {
+                    // Return first successful child branch
+                case NodeState::SUCCESS:
+                    return NodeState::SUCCESS;
+                    // Return first running child branch
+                case NodeState::RUNNING:
+                    return NodeState::RUNNING;
+                    // Try the next child branch
+                case NodeState::FAILURE:
+                    break;
+                }
             }
-            // Some nodes are still running
-            if (!allSuccess) return NodeState::RUNNING;
-            // All nodes are done
-            return NodeState::SUCCESS;
+            // All sub-branches failed
+            return NodeState::FAILURE;
+        }
+
+        NodeState _evaluate_instance(T* context, NodeState* states) override
+        {
+            for (Node<T>* child : this->children)
+            {
+                const NodeState state = child->eval(context, states);
+                // Return first successful or running child branch
+                if (state != NodeState::FAILURE) return state;
+            }
+            // All sub-branches failed
+            return NodeState::FAILURE;
+        }
+
+        StatePlanes _evaluate_lanes(LaneBlock<T>& block, LaneMask active) override
+        {
+            StatePlanes result = {0, 0};
+            // Lanes are decided by their first child that does not fail
+            for (Node<T>* child : this->children)
+            {
+                if (active == 0) break;
+                const StatePlanes states = child->_evaluate_lanes(block, active);
+                result.done |= states.success;
+                result.success |= states.success;
+                active = states.failure();
+            }
+            // All sub-branches failed
+            result.done |= active;
+            return result;
+        }
+
+        void _evaluate_wave(Wavefront<T>& wave, const std::vector<std::size_t>& agents, NodeState* states) override
+        {
+            // Positions in agents that have not found a child that does not fail
+            std::vector<std::size_t> pending(agents.size());
+            for (std::size_t i = 0; i < pending.size(); i++) pending[i] = i;
+
+            std::vector<std::size_t> reached;
+            std::vector<NodeState> results;
+            for (Node<T>* child : this->children)
+            {
+                if (pending.empty()) break;
+                reached.clear();
+                for (std::size_t position : pending) reached.push_back(agents[position]);
+                results.resize(reached.size());
+                child->_evaluate_wave(wave, reached, results.data());
+
+                std::size_t kept = 0;
+                for (std::size_t i = 0; i < pending.size(); i++)
+                {
+                    if (results[i] == NodeState::FAILURE) pending[kept++] = pending[i];
+                    else states[pending[i]] = results[i];
+                }
+                pending.resize(kept);
+            }
+            // All sub-branches failed
+            for (std::size_t position : pending) states[position] = NodeState::FAILURE;
         }
     };
 
-    template<class T>
-    class IDecorator : public Node<T> {
+
+    /**
+     * Key value store that notifies observers when the value of a key changes.
+     * Values of a key must always be set with the same type, which must be equality comparable.
+     */
+    class Blackboard
+    {
     public:
-        IDecorator(Node<T>* child, std::string name = "") : Node<T>(nullptr, name)
+        typedef std::size_t ObserverId;
+
+        Blackboard() = default;
+        Blackboard(const Blackboard&) = delete;
+        Blackboard& operator=(const Blackboard&) = delete;
+
+        /**
+         * Set the value of a key. Observers of the key are notified if the value changed.
+         * @throws bad_any_cast if the key holds a value of a different type
+         */
+        template<class V>
+        void set(const std::string& key, const V& value)
         {
-            this->child = child;
-            child->parent = this;
+            Entry& entry = _entries[key];
+            if (entry.value.has_value() && std::any_cast<const V&>(entry.value) == value) return;
+            entry.value = value;
+            for (std::size_t i = 0; i < entry.observers.size(); i++)
+            {
+                entry.observers[i].callback();
+            }
         }
 
-        NodeState _evaluate() override
+        /**
+         * @return The value of the key, nullptr if it is not set or holds a different type
+         */
+        template<class V>
+        const V* get(const std::string& key) const
         {
-            return decorate(child.eval());
+            auto it = _entries.find(key);
+            if (it == _entries.end()) return nullptr;
+            return std::any_cast<V>(&it->second.value);
         }
 
-        void _propagate_context() override
+        /**
+         * Call callback whenever the value of key changes
+         * @return Id to stop observing with
+         */
+        ObserverId observe(const std::string& key, std::function<void()> callback)
         {
-            child->context = this->context;
-            child->DEBUG = this->DEBUG;
-            child->_propagate_context();
+            const ObserverId id = _nextObserver++;
+            _entries[key].observers.push_back(Observer{id, std::move(callback)});
+            _observed[id] = key;
+            return id;
         }
 
-        virtual NodeState decorate(NodeState childEvaluation) = 0;
+        void unobserve(ObserverId id)
+        {
+            auto it = _observed.find(id);
+            if (it == _observed.end()) return;
 
-        Node<T>* child;
+            std::vector<Observer>& observers = _entries[it->second].observers;
+            for (std::size_t i = 0; i < observers.size(); i++)
+            {
+                if (observers[i].id == id)
+                {
+                    observers.erase(observers.begin() + i);
+                    break;
+                }
+            }
+            _observed.erase(it);
+        }
+
+    private:
+        struct Observer
+        {
+            ObserverId id;
+            std::function<void()> callback;
+        };
+
+        struct Entry
+        {
+            std::any value;
+            std::vector<Observer> observers;
+        };
+
+        std::unordered_map<std::string, Entry> _entries;
+        std::unordered_map<ObserverId, std::string> _observed; // Key of each observer
+        ObserverId _nextObserver = 0;
     };
 
+    /**
+     * A selector that keeps evaluating its RUNNING child without re-evaluating the higher priority children,
+     * unless blackboard keys those children observe have changed.
+     *
+     * - Without a running child it behaves like ISelectorBranch.
+     * - While a child is RUNNING, only higher priority children whose observed keys changed since the last tick
+     *   are evaluated, in priority order. The first of them that evaluates to SUCCESS or RUNNING aborts (halts)
+     *   the running child and its state is returned.
+     * - Otherwise the running child is evaluated and its state is returned.
+     *   If it fails, the children after it are evaluated like in ISelectorBranch.
+     *
+     * Higher priority children that observe no keys cannot abort a running child.
+     *
+     * @tparam T Data context class of behavior tree
+     */
     template<class T>
-    class Inverter : public IDecorator<T> {
+    class IObserverSelector : public Node<T>
+    {
     public:
-        Inverter(Node<T>* child) : IDecorator<T>(child, "Inverter")
+        /**
+         * Attach the children to the node within the constructor using the
+         * _attach(child*) and _attach_observing(child*, blackboard, keys) methods
+         */
+        explicit IObserverSelector(std::string name = "") : Node<T>(nullptr, name)
         {}
-        NodeState decorate(NodeState childEvaluation) override
+
+        ~IObserverSelector() override
         {
-            // Invert Success and Failure states.
-            if (childEvaluation == NodeState::SUCCESS) return NodeState::FAILURE;
-            if (childEvaluation == NodeState::FAILURE) return NodeState::SUCCESS;
-            if (childEvaluation == NodeState::RUNNING) return NodeState::RUNNING;
+            for (const Registration& registration : _registrations)
+            {
+                registration.blackboard->unobserve(registration.id);
+            }
+        }
+
+        /**
+         * Attach a child that is re-evaluated while a lower priority child runs whenever one of the keys changes
+         */
+        void _attach_observing(Node<T>* child, Blackboard& blackboard, const std::vector<std::string>& keys)
+        {
+            const std::size_t index = this->children.size();
+            this->_attach(child);
+            for (const std::string& key : keys)
+            {
+                const Blackboard::ObserverId id = blackboard.observe(key, [this, index]() { _dirty[index] = true; });
+                _registrations.push_back(Registration{&blackboard, id});
+            }
+        }
+
+        void _attach(Node<T>* node) override
+        {
+            Node<T>::_attach(node);
+            _dirty.push_back(false);
+        }
+
+        NodeState _evaluate() override
+        {
+            const std::size_t count = this->children.size();
+            std::size_t first = 0;
+
+            if (_running < count && this->children[_running]->state == NodeState::RUNNING)
+            {
+                // Only higher priority children with changed inputs may abort the running child
+                for (std::size_t i = 0; i < _running; i++)
+                {
+                    if (!_dirty[i]) continue;
+                    _dirty[i] = false;
+                    if (this->children[i]->eval() != NodeState::FAILURE)
+                    {
+                        this->children[_running]->_halt();
+                        _running = i;
+                        return this->children[i]->state;
+                    }
+                }
+                first = _running;
+            }
+
+            for (std::size_t i = 0; i < first; i++)
+            {
+                _dirty[i] = false;
+            }
+            for (std::size_t i = first; i < count; i++)
+            {
+                _dirty[i] = false;
+                if (this->children[i]->eval() != NodeState::FAILURE)
+                {
+                    _running = i;
+                    return this->children[i]->state;
+                }
+            }
+            _running = count;
+            return NodeState::FAILURE;
+        }
+
+        void _halt() override
+        {
+            Node<T>::_halt();
+            _running = this->children.size();
+        }
+
+        std::any _save() const override
+        {
+            return std::make_pair(_dirty, _running);
+        }
+
+        void _restore(const std::any& saved) override
+        {
+            const auto& members = std::any_cast<const std::pair<std::vector<bool>, std::size_t>&>(saved);
+            _dirty = members.first;
+            _running = members.second;
+        }
+
+    private:
+        struct Registration
+        {
+            Blackboard* blackboard;
+            Blackboard::ObserverId id;
+        };
+
+        std::vector<bool> _dirty;                 // Observed keys of the child changed
+        std::vector<Registration> _registrations; // Observers to remove on destruction
+        std::size_t _running = 0;                 // Child that returned last tick, >= children.size() if none
+    };
+
+
+    /**
+     * A sequence tries to evaluate all it's children
+     *
+     * The nodes in the sequence's children are iterated over and evaluated by calling evaluate.
+     * These child nodes can be other branches, decorators, or leaf nodes.
+     *
+     * - If any of the nodes return a FAILURE state, the sequence is aborted and returns FAILURE.
+     * - If all nodes return a SUCCESS state, the sequence returns SUCCESS.
+     * - If a node returns RUNNING, the sequence stops and returns RUNNING.
+     *
+     * @tparam T Data context class of behavior tree
+     */
+    template<class T>
+    class ISequenceBranch : public Node<T> {
+    public:
+        /**
+         * Attach the children to the node within the constructor using the _attach(child*) method
+         */
+        explicit ISequenceBranch(std::string name = "") : Node<T>(nullptr, name)
+        {}
+
+        NodeState _evaluate() override
+        {
+            // Iterate and evaluate all children
+            for (Node<T>* child : this->children)
+            {
+                // Assign new child state
+                child->eval();
+                // Stop iterating if the state isn't success
+                if (child->state != NodeState::SUCCESS)
+                {
+                    return child->state;
+                }
+            }
+            // All child nodes returned success
+            return NodeState::SUCCESS;
+        }
+
+        NodeState _evaluate_instance(T* context, NodeState* states) override
+        {
+            for (Node<T>* child : this->children)
+            {
+                const NodeState state = child->eval(context, states);
+                // Stop iterating if the state isn't success
+                if (state != NodeState::SUCCESS) return state;
+            }
+            // All child nodes returned success
+            return NodeState::SUCCESS;
+        }
+
+        StatePlanes _evaluate_lanes(LaneBlock<T>& block, LaneMask active) override
+        {
+            StatePlanes result = {0, 0};
+            // Only lanes where every previous child succeeded continue
+            for (Node<T>* child : this->children)
+            {
+                if (active == 0) break;
+                const StatePlanes states = child->_evaluate_lanes(block, active);
+                result.done |= states.failure();
+                active = states.success;
+            }
+            // All child nodes returned success
+            result.done |= active;
+            result.success = active;
+            return result;
+        }
+
+        void _evaluate_wave(Wavefront<T>& wave, const std::vector<std::size_t>& agents, NodeState* states) override
+        {
+            // Positions in agents where every previous child succeeded
+            std::vector<std::size_t> pending(agents.size());
+            for (std::size_t i = 0; i < pending.size(); i++) pending[i] = i;
+
+            std::vector<std::size_t> reached;
+            std::vector<NodeState> results;
+            for (Node<T>* child : this->children)
+            {
+                if (pending.empty()) break;
+                reached.clear();
+                for (std::size_t position : pending) reached.push_back(agents[position]);
+                results.resize(reached.size());
+                child->_evaluate_wave(wave, reached, results.data());
+
+                std::size_t kept = 0;
+                for (std::size_t i = 0; i < pending.size(); i++)
+                {
+                    if (results[i] == NodeState::SUCCESS) pending[kept++] = pending[i];
+                    else states[pending[i]] = results[i];
+                }
+                pending.resize(kept);
+            }
+            // All child nodes returned success
+            for (std::size_t position : pending) states[position] = NodeState::SUCCESS;
+        }
+    };
+
+    /**
+     * A switch jumps directly to the child attached for the key read from the context.
+     * Replaces selectors of sequences that each start with a state check, which cost one condition per case.
+     *
+     * Cases are stored in a dense jump table indexed by key, so keys should be small integers or enum values.
+     *
+     * - Evaluates the child attached for key() and returns its state.
+     * - Evaluates the default child if no child is attached for the key.
+     * - Evaluates to FAILURE if there is neither a matching case nor a default child.
+     * - A RUNNING child is halted when the key selects a different child.
+     *
+     * Requires an implementation of the key() method.
+     *
+     * @tparam T Data context class of behavior tree
+     */
+    template<class T>
+    class ISwitchBranch : public Node<T>
+    {
+    public:
+        /**
+         * Attach the children to the node within the constructor using the _attach_case(key, child*)
+         * and _attach_default(child*) methods
+         */
+        explicit ISwitchBranch(std::string name = "") : Node<T>(nullptr, name)
+        {}
+
+        NodeState _evaluate() override
+        {
+            Node<T>* child = _select(key());
+            // Halt the previous case if the key moved on while it was running
+            if (_active != nullptr && _active != child && _active->state == NodeState::RUNNING)
+                _active->_halt();
+            _active = child;
+
+            if (child == nullptr) return NodeState::FAILURE;
+            return child->eval();
+        }
+
+        /**
+         * Reads the key of the case to evaluate from the context.
+         * @return The key, cast to int for enum keys
+         */
+        virtual int key() = 0;
+
+        /**
+         * Attach the child evaluated for the given key
+         * @tparam K int or enum type
+         * @throws runtime_error if a child is already attached for the key
+         */
+        template<class K>
+        void _attach_case(K key, Node<T>* child)
+        {
+            const int value = static_cast<int>(key);
+            if (_table.empty())
+            {
+                _offset = value;
+                _table.push_back(nullptr);
+            }
+            else if (value < _offset)
+            {
+                _table.insert(_table.begin(), std::size_t(_offset - value), nullptr);
+                _offset = value;
+            }
+            else if (std::size_t(value - _offset) >= _table.size())
+            {
+                _table.resize(std::size_t(value - _offset) + 1, nullptr);
+            }
+
+            Node<T>*& entry = _table[std::size_t(value - _offset)];
+            if (entry != nullptr)
+                throw std::runtime_error("Switch case " + std::to_string(value) + " attached twice");
+            entry = child;
+            this->_attach(child);
+        }
+
+        /**
+         * Attach the child evaluated for keys without a case
+         */
+        void _attach_default(Node<T>* child)
+        {
+            _default = child;
+            this->_attach(child);
+        }
+
+        std::any _save() const override
+        {
+            return _active;
+        }
+
+        void _restore(const std::any& saved) override
+        {
+            _active = std::any_cast<Node<T>*>(saved);
+        }
+
+    private:
+        std::vector<Node<T>*> _table;  // Jump table, entry i holds the case for key _offset + i
+        int _offset = 0;               // Smallest attached key
+        Node<T>* _default = nullptr;   // Child for keys without a case
+        Node<T>* _active = nullptr;    // Child evaluated on the previous tick
+
+        Node<T>* _select(int key) const
+        {
+            // Unsigned compare covers keys below and above the table range
+            const std::size_t index = std::size_t(key) - std::size_t(_offset);
+            if (index < _table.size() && _table[index] != nullptr) return _table[index];
+            return _default;
+        }
+    };
+
+    /**
+     * A rule of a decision table. Bit i of the masks refers to condition i of the table.
+     */
+    struct DecisionRule
+    {
+        std::uint32_t care;  // Conditions the rule depends on
+        std::uint32_t value; // Required results of the conditions in care
+        int outcome;         // Index of the outcome child, -1 evaluates to FAILURE
+
+        /**
+         * Build a rule from a pattern where character i describes condition i:
+         * '1' must hold, '0' must not hold, '-' does not matter. Example: rule("1-0", 2)
+         * @throws runtime_error on invalid characters or more than 16 conditions
+         */
+        static DecisionRule rule(const std::string& pattern, int outcome)
+        {
+            if (pattern.size() > 16)
+                throw std::runtime_error("Decision rule has more than 16 conditions");
+
+            DecisionRule rule = {0, 0, outcome};
+            for (std::size_t i = 0; i < pattern.size(); i++)
+            {
+                const std::uint32_t bit = std::uint32_t(1) << i;
+                switch (pattern[i])
+                {
+                case '1':
+                    rule.care |= bit;
+                    rule.value |= bit;
+                    break;
+                case '0':
+                    rule.care |= bit;
+                    break;
+                case '-':
+                    break;
+                default:
+                    throw std::runtime_error("Invalid decision rule pattern '" + pattern + "'");
+                }
+            }
+            return rule;
+        }
+
+        /**
+         * Compiles an ordered rule list into a lookup table with one entry per combination of condition results.
+         * The first matching rule decides the entry. Combinations no rule matches map to -1.
+         * @param rules Rules in priority order
+         * @param conditions Number of conditions, at most 16
+         * @return Table indexed by the bitmask of condition results
+         * @throws runtime_error if there are more than 16 conditions or a rule depends on a missing condition
+         */
+        static std::vector<int> compile(const std::vector<DecisionRule>& rules, std::size_t conditions)
+        {
+            if (conditions > 16)
+                throw std::runtime_error("Decision table supports at most 16 conditions");
+
+            const std::uint32_t size = std::uint32_t(1) << conditions;
+            for (const DecisionRule& rule : rules)
+            {
+                if ((rule.care & ~(size - 1)) != 0)
+                    throw std::runtime_error("Decision rule depends on a condition that is not attached");
+            }
+
+            std::vector<int> table(size, -1);
+            for (std::uint32_t mask = 0; mask < size; mask++)
+            {
+                for (const DecisionRule& rule : rules)
+                {
+                    if ((mask & rule.care) == rule.value)
+                    {
+                        table[mask] = rule.outcome;
+                        break;
+                    }
+                }
+            }
+            return table;
+        }
+    };
+
+    /**
+     * A decision table evaluates each condition once per tick, packs the results into a bitmask and
+     * looks up the outcome child to evaluate in a table compiled from a list of rules.
+     * Replaces nested selectors, sequences and inverters that check the same conditions along several paths.
+     *
+     * - Conditions that evaluate to SUCCESS set their bit. FAILURE and RUNNING leave it cleared.
+     * - Evaluates the outcome child of the first rule matching the condition results and returns its state.
+     * - Evaluates to FAILURE if no rule matches.
+     * - A RUNNING outcome is halted when the table selects a different outcome.
+     *
+     * @tparam T Data context class of behavior tree
+     */
+    template<class T>
+    class IDecisionTable : public Node<T>
+    {
+    public:
+        /**
+         * Attach conditions, outcomes and rules within the constructor using the
+         * _attach_condition(child*), _attach_outcome(child*) and _rule(pattern, outcome) methods
+         */
+        explicit IDecisionTable(std::string name = "") : Node<T>(nullptr, name)
+        {}
+
+        NodeState _evaluate() override
+        {
+            if (_table.size() != (std::size_t(1) << _conditions.size()))
+                _table = DecisionRule::compile(_rules, _conditions.size());
+
+            // Evaluate every condition exactly once
+            std::uint32_t mask = 0;
+            for (std::size_t i = 0; i < _conditions.size(); i++)
+            {
+                if (_conditions[i]->eval() == NodeState::SUCCESS) mask |= std::uint32_t(1) << i;
+            }
+
+            const int index = _table[mask];
+            Node<T>* outcome = index < 0 ? nullptr : _outcomes[std::size_t(index)];
+            // Halt the previous outcome if the decision changed while it was running
+            if (_active != nullptr && _active != outcome && _active->state == NodeState::RUNNING)
+                _active->_halt();
+            _active = outcome;
+
+            if (outcome == nullptr) return NodeState::FAILURE;
+            return outcome->eval();
+        }
+
+        /**
+         * Attach a condition. Its index is its bit in the rules.
+         * @return Index of the condition
+         * @throws runtime_error if more than 16 conditions are attached
+         */
+        std::size_t _attach_condition(Node<T>* condition)
+        {
+            if (_conditions.size() == 16)
+                throw std::runtime_error("Decision table supports at most 16 conditions");
+            _conditions.push_back(condition);
+            this->_attach(condition);
+            return _conditions.size() - 1;
+        }
+
+        /**
+         * Attach an outcome child
+         * @return Index of the outcome for use in rules
+         */
+        int _attach_outcome(Node<T>* outcome)
+        {
+            _outcomes.push_back(outcome);
+            this->_attach(outcome);
+            return int(_outcomes.size() - 1);
+        }
+
+        /**
+         * Add a rule. Rules are matched in the order they are added.
+         * @throws runtime_error if the outcome is not attached
+         */
+        void _rule(const DecisionRule& rule)
+        {
+            if (rule.outcome >= int(_outcomes.size()))
+                throw std::runtime_error("Decision rule outcome not attached");
+            _rules.push_back(rule);
+            _table.clear();
+        }
+
+        /**
+         * Add a rule from a pattern, see DecisionRule::rule
+         */
+        void _rule(const std::string& pattern, int outcome)
+        {
+            _rule(DecisionRule::rule(pattern, outcome));
+        }
+
+        std::any _save() const override
+        {
+            return _active;
+        }
+
+        void _restore(const std::any& saved) override
+        {
+            _active = std::any_cast<Node<T>*>(saved);
+        }
+
+    private:
+        std::vector<Node<T>*> _conditions; // Condition children, one bit each
+        std::vector<Node<T>*> _outcomes;   // Outcome children selected by the table
+        std::vector<DecisionRule> _rules;  // Rules in priority order
+        std::vector<int> _table;           // Compiled outcome index per condition bitmask
+        Node<T>* _active = nullptr;        // Outcome evaluated on the previous tick
+    };
+
+    /**
+     * A state machine embedded in the tree. States are child subtrees and transitions are guarded by condition nodes.
+     * State machines can be used as states of other state machines to build hierarchies.
+     *
+     * Each tick only the outgoing transitions of the active state and the active state itself are evaluated:
+     * - Guards of the active state are evaluated in the order they were added.
+     *   The first guard that evaluates to SUCCESS halts the active state if it is running and activates the target.
+     * - The active state is evaluated and its state is returned.
+     * - Halting the state machine halts the active state and returns to the initial state.
+     *
+     * @tparam T Data context class of behavior tree
+     */
+    template<class T>
+    class IStateMachine : public Node<T>
+    {
+    public:
+        /**
+         * Attach states and transitions within the constructor using the
+         * _attach_state(child*) and _attach_transition(from, guard*, to) methods.
+         * The first attached state is the initial state.
+         */
+        explicit IStateMachine(std::string name = "") : Node<T>(nullptr, name)
+        {}
+
+        NodeState _evaluate() override
+        {
+            if (_states.empty()) return NodeState::FAILURE;
+
+            for (const Transition& transition : _states[_active].transitions)
+            {
+                if (transition.guard->eval() == NodeState::SUCCESS)
+                {
+                    Node<T>* state = _states[_active].node;
+                    if (state->state == NodeState::RUNNING) state->_halt();
+                    _active = transition.to;
+                    break;
+                }
+            }
+            return _states[_active].node->eval();
+        }
+
+        void _halt() override
+        {
+            Node<T>::_halt();
+            _active = 0;
+        }
+
+        /**
+         * Attach a state
+         * @return Index of the state for use in transitions
+         */
+        std::size_t _attach_state(Node<T>* state)
+        {
+            _states.push_back(State{state, {}});
+            this->_attach(state);
+            return _states.size() - 1;
+        }
+
+        /**
+         * Attach a transition that activates state 'to' when guard evaluates to SUCCESS while 'from' is active
+         * @throws runtime_error if a state is not attached
+         */
+        void _attach_transition(std::size_t from, Node<T>* guard, std::size_t to)
+        {
+            if (from >= _states.size() || to >= _states.size())
+                throw std::runtime_error("State machine transition between unattached states");
+            _states[from].transitions.push_back(Transition{guard, to});
+            this->_attach(guard);
+        }
+
+        /**
+         * @return Index of the active state
+         */
+        std::size_t active() const { return _active; }
+
+        std::any _save() const override
+        {
+            return _active;
+        }
+
+        void _restore(const std::any& saved) override
+        {
+            _active = std::any_cast<std::size_t>(saved);
+        }
+
+    private:
+        struct Transition
+        {
+            Node<T>* guard;  // Condition activating the target
+            std::size_t to;  // Target state index
+        };
+
+        struct State
+        {
+            Node<T>* node;                        // Subtree evaluated while the state is active
+            std::vector<Transition> transitions;  // Outgoing transitions in priority order
+        };
+
+        std::vector<State> _states;
+        std::size_t _active = 0;
+    };
+
+    /**
+     * A set of required bit values in a planner world state. Used for preconditions, effects and goals.
+     */
+    struct WorldCondition
+    {
+        std::uint64_t mask;  // Bits the condition refers to
+        std::uint64_t value; // Required values of the bits in mask
+
+        bool holds(std::uint64_t state) const { return (state & mask) == value; }
+
+        /**
+         * @return The state with the bits in mask set to value
+         */
+        std::uint64_t apply(std::uint64_t state) const { return (state & ~mask) | value; }
+    };
+
+    /**
+     * Goal oriented action planning node. Plans a sequence of declared actions that reaches the goal from the
+     * current world state with A*, and executes the plan by evaluating the actions' subtrees in order.
+     *
+     * - Plans are cached by goal and by the bits of the world state any precondition or the goal refers to.
+     * - The remaining plan is kept as long as it still reaches the goal from the current world state.
+     *   Planning only starts again when such an assumption breaks or a step evaluates to FAILURE.
+     *   The cached plan is discarded when one of its steps fails.
+     * - Planning is time sliced: at most expansionsPerTick search nodes are expanded per tick.
+     *
+     * Evaluates to SUCCESS when the goal holds, RUNNING while planning or executing,
+     * and FAILURE when no plan reaches the goal.
+     *
+     * Requires an implementation of the worldState() and goal() methods.
+     *
+     * @tparam T Data context class of behavior tree
+     */
+    template<class T>
+    class IPlannerAction : public Node<T>
+    {
+    public:
+        std::size_t expansionsPerTick; // Planning budget per tick
+        std::size_t cacheCapacity;     // Cached plans kept before the cache is cleared
+
+        /**
+         * Attach the actions within the constructor using the _attach_action(step*, precondition, effect, cost) method
+         */
+        explicit IPlannerAction(std::string name = "", std::size_t expansionsPerTick = 64, std::size_t cacheCapacity = 256)
+            : Node<T>(nullptr, name), expansionsPerTick(expansionsPerTick), cacheCapacity(cacheCapacity)
+        {}
+
+        /**
+         * Reads the world state from the context
+         * @return One bit per world state fact
+         */
+        virtual std::uint64_t worldState() = 0;
+
+        /**
+         * @return The condition the plan must reach
+         */
+        virtual WorldCondition goal() = 0;
+
+        NodeState _evaluate() override
+        {
+            const WorldCondition target = goal();
+            // A new goal invalidates the search and the plan
+            if (target.mask != _goal.mask || target.value != _goal.value)
+            {
+                _halt_step();
+                _reset();
+                _goal = target;
+            }
+
+            bool planned = false;
+            while (true)
+            {
+                const std::uint64_t state = worldState();
+
+                if (_searching)
+                {
+                    if (!_search()) return _searching ? NodeState::RUNNING : NodeState::FAILURE;
+                    continue;
+                }
+
+                // Keep executing while the remaining plan still reaches the goal
+                if (_step >= _plan.size() || !_valid(state))
+                {
+                    _halt_step();
+                    _plan.clear();
+                    _step = 0;
+                    if (_goal.holds(state)) return NodeState::SUCCESS;
+
+                    // Plan at most once per tick, steps that succeed without their effect would loop otherwise
+                    if (planned) return NodeState::RUNNING;
+                    planned = true;
+
+                    const PlanKey key = {state & (_preconditionBits | _goal.mask), _goal.mask, _goal.value};
+                    auto cached = _cache.find(key);
+                    if (cached != _cache.end())
+                    {
+                        _plan = cached->second;
+                        _origin = key.state;
+                    }
+                    else
+                    {
+                        _begin(key.state);
+                    }
+                    continue;
+                }
+
+                Node<T>* step = _actions[_plan[_step]].step;
+                switch (step->eval())
+                {
+                case NodeState::RUNNING:
+                    return NodeState::RUNNING;
+                case NodeState::FAILURE:
+                    // The plan does not work from its origin, plan again next tick
+                    _cache.erase(PlanKey{_origin, _goal.mask, _goal.value});
+                    _plan.clear();
+                    _step = 0;
+                    return NodeState::RUNNING;
+                case NodeState::SUCCESS:
+                    _step++;
+                    break;
+                }
+            }
+        }
+
+        void _halt() override
+        {
+            Node<T>::_halt();
+            _reset();
+        }
+
+        /**
+         * Attach a plannable action
+         * @param step The subtree executing the action
+         * @param precondition Must hold for the action to be planned
+         * @param effect Applied to the world state when the action succeeds
+         * @param cost Cost of the action, must be positive
+         * @return Index of the action
+         */
+        std::size_t _attach_action(Node<T>* step, WorldCondition precondition, WorldCondition effect, float cost = 1.0f)
+        {
+            _actions.push_back(Action{step, precondition, effect, cost});
+            _preconditionBits |= precondition.mask;
+            _minCost = _actions.size() == 1 ? cost : std::min(_minCost, cost);
+            _maxEffectBits = std::max(_maxEffectBits, _bits(effect.mask));
+            this->_attach(step);
+            return _actions.size() - 1;
+        }
+
+        /**
+         * Discard all cached plans
+         */
+        void clearCache() { _cache.clear(); }
+
+        std::any _save() const override
+        {
+            return Saved{_cache, _plan, _step, _origin, _searching, _goal, _open, _visits};
+        }
+
+        void _restore(const std::any& saved) override
+        {
+            const Saved& members = std::any_cast<const Saved&>(saved);
+            _cache = members.cache;
+            _plan = members.plan;
+            _step = members.step;
+            _origin = members.origin;
+            _searching = members.searching;
+            _goal = members.goal;
+            _open = members.open;
+            _visits = members.visits;
+        }
+
+    private:
+        struct Action
+        {
+            Node<T>* step;
+            WorldCondition precondition;
+            WorldCondition effect;
+            float cost;
+        };
+
+        struct PlanKey
+        {
+            std::uint64_t state;
+            std::uint64_t goalMask;
+            std::uint64_t goalValue;
+
+            bool operator==(const PlanKey& other) const
+            {
+                return state == other.state && goalMask == other.goalMask && goalValue == other.goalValue;
+            }
+        };
+
+        struct PlanKeyHash
+        {
+            std::size_t operator()(const PlanKey& key) const
+            {
+                std::uint64_t hash = key.state * 0x9E3779B97F4A7C15ull;
+                hash ^= key.goalMask + 0x9E3779B97F4A7C15ull + (hash << 6) + (hash >> 2);
+                hash ^= key.goalValue + 0x9E3779B97F4A7C15ull + (hash << 6) + (hash >> 2);
+                return std::size_t(hash);
+            }
+        };
+
+        struct Visit
+        {
+            float cost;             // Cost from the origin
+            std::uint64_t previous; // State this one was reached from
+            std::size_t action;     // Action leading here
+            bool closed;
+        };
+
+        struct Open
+        {
+            float priority;
+            std::uint64_t state;
+            bool operator<(const Open& other) const { return priority > other.priority; }
+        };
+
+        std::vector<Action> _actions;
+        std::uint64_t _preconditionBits = 0;
+        float _minCost = 0.0f;       // Cheapest action
+        float _maxEffectBits = 1.0f; // Most bits any action sets, at least 1
+        std::unordered_map<PlanKey, std::vector<std::size_t>, PlanKeyHash> _cache;
+
+        // Execution
+        std::vector<std::size_t> _plan; // Action indices
+        std::size_t _step = 0;          // Plan step being executed
+        std::uint64_t _origin = 0;      // Relevant state the plan was made for
+
+        // Time sliced search
+        bool _searching = false;
+        WorldCondition _goal = {0, 0};
+        std::priority_queue<Open> _open;
+        std::unordered_map<std::uint64_t, Visit> _visits;
+
+        // Runtime members for TreeSnapshot
+        struct Saved
+        {
+            std::unordered_map<PlanKey, std::vector<std::size_t>, PlanKeyHash> cache;
+            std::vector<std::size_t> plan;
+            std::size_t step;
+            std::uint64_t origin;
+            bool searching;
+            WorldCondition goal;
+            std::priority_queue<Open> open;
+            std::unordered_map<std::uint64_t, Visit> visits;
+        };
+
+        /**
+         * @return true if the remaining steps of the plan are applicable from state and reach the goal
+         */
+        bool _valid(std::uint64_t state) const
+        {
+            for (std::size_t i = _step; i < _plan.size(); i++)
+            {
+                const Action& action = _actions[_plan[i]];
+                // A running step already started, its precondition may have been consumed
+                const bool started = i == _step && action.step->state == NodeState::RUNNING;
+                if (!started && !action.precondition.holds(state)) return false;
+                state = action.effect.apply(state);
+            }
+            return _goal.holds(state);
+        }
+
+        void _begin(std::uint64_t origin)
+        {
+            _searching = true;
+            _origin = origin;
+            _visits[origin] = Visit{0.0f, origin, 0, false};
+            _open.push(Open{_heuristic(origin), origin});
+        }
+
+        /**
+         * Expands up to expansionsPerTick search nodes
+         * @return true when a plan was found, false if the budget ran out or no plan exists
+         */
+        bool _search()
+        {
+            for (std::size_t expansions = 0; expansions < expansionsPerTick; expansions++)
+            {
+                if (_open.empty())
+                {
+                    _stop_search();
+                    return false;
+                }
+
+                const std::uint64_t state = _open.top().state;
+                _open.pop();
+                Visit& visit = _visits[state];
+                if (visit.closed) continue;
+                visit.closed = true;
+
+                if (_goal.holds(state))
+                {
+                    _finish(state);
+                    return true;
+                }
+
+                const float cost = visit.cost;
+                for (std::size_t i = 0; i < _actions.size(); i++)
+                {
+                    const Action& action = _actions[i];
+                    if (!action.precondition.holds(state)) continue;
+
+                    const std::uint64_t next = action.effect.apply(state);
+                    const float nextCost = cost + action.cost;
+                    auto found = _visits.find(next);
+                    if (found != _visits.end() && (found->second.closed || found->second.cost <= nextCost)) continue;
+
+                    _visits[next] = Visit{nextCost, state, i, false};
+                    _open.push(Open{nextCost + _heuristic(next), next});
+                }
+            }
+            return false;
+        }
+
+        /**
+         * Unsatisfied goal bits, each at the cost of the cheapest action shared by the most bits an action sets.
+         * Never overestimates and drops by at most one action cost per step, so the closed set keeps plans optimal.
+         * @return Lower bound of the cost to reach the goal
+         */
+        float _heuristic(std::uint64_t state) const
+        {
+            return _bits((state & _goal.mask) ^ _goal.value) * _minCost / _maxEffectBits;
+        }
+
+        static float _bits(std::uint64_t mask)
+        {
+            float count = 0.0f;
+            for (; mask != 0; mask &= mask - 1) count += 1.0f;
+            return count;
+        }
+
+        void _finish(std::uint64_t state)
+        {
+            std::vector<std::size_t> plan;
+            while (state != _origin)
+            {
+                const Visit& visit = _visits[state];
+                plan.push_back(visit.action);
+                state = visit.previous;
+            }
+            _plan.assign(plan.rbegin(), plan.rend());
+            _step = 0;
+            _stop_search();
+
+            if (_cache.size() >= cacheCapacity) _cache.clear();
+            _cache[PlanKey{_origin, _goal.mask, _goal.value}] = _plan;
+        }
+
+        void _halt_step()
+        {
+            if (_step < _plan.size())
+            {
+                Node<T>* step = _actions[_plan[_step]].step;
+                if (step->state == NodeState::RUNNING) step->_halt();
+            }
+        }
+
+        void _stop_search()
+        {
+            _searching = false;
+            _open = std::priority_queue<Open>();
+            _visits.clear();
+        }
+
+        /**
+         * Stops searching and executing
+         */
+        void _reset()
+        {
+            _stop_search();
+            _plan.clear();
+            _step = 0;
+        }
+    };
+
+    /**
+     * Captures the runtime state of a subtree so it can be evaluated speculatively and restored afterwards.
+     * The subtree is compiled into a flat node list once; capture and restore are linear passes over it.
+     * Besides context and state, the runtime members of nodes are saved through Node::_save and _restore,
+     * so leaves keeping their own members must override those as well.
+     *
+     * @tparam T Data context class of behavior tree
+     */
+    template<class T>
+    class TreeSnapshot
+    {
+    public:
+        explicit TreeSnapshot(Node<T>* tree)
+        {
+            tree->_collect(_nodes);
+            _contexts.resize(_nodes.size());
+            _states.resize(_nodes.size());
+            _members.resize(_nodes.size());
+            capture();
+        }
+
+        /**
+         * Saves the context, state and runtime members of every node
+         */
+        void capture()
+        {
+            for (std::size_t i = 0; i < _nodes.size(); i++)
+            {
+                _contexts[i] = _nodes[i]->context;
+                _states[i] = _nodes[i]->state;
+                _members[i] = _nodes[i]->_save();
+            }
+        }
+
+        /**
+         * Restores the context, state and runtime members of every node saved by the last capture
+         */
+        void restore()
+        {
+            for (std::size_t i = 0; i < _nodes.size(); i++)
+            {
+                _nodes[i]->context = _contexts[i];
+                _nodes[i]->state = _states[i];
+                if (_members[i].has_value()) _nodes[i]->_restore(_members[i]);
+            }
+        }
+
+        /**
+         * Binds a context to every node without walking the tree
+         */
+        void bind(T* context)
+        {
+            for (Node<T>* node : _nodes)
+            {
+                node->context = context;
+            }
+        }
+
+    private:
+        std::vector<Node<T>*> _nodes;
+        std::vector<T*> _contexts;
+        std::vector<NodeState> _states;
+        std::vector<std::any> _members;
+    };
+
+    /**
+     * Chooses between its children by simulating each of them on a copy of the context
+     * for a number of virtual ticks, and commits to the child with the best score.
+     *
+     * - While no child is committed, every child is simulated for up to horizon ticks on its own fork of the context.
+     *   Simulation stops early when the child no longer evaluates to RUNNING.
+     *   The node states of the simulated subtrees are restored afterwards.
+     * - The child with the highest score is evaluated on the real context and its state is returned.
+     * - A child that evaluates to RUNNING stays committed and is evaluated directly on the next ticks.
+     *
+     * With parallel set, children are simulated concurrently on workers the node keeps for its lifetime.
+     * Leaves must then only act through their context, and children must not share nodes through SubtreeRef.
+     * Only worth it when simulations are expensive, children are simulated one after another by default.
+     *
+     * Requires an implementation of the score() method. Override fork() if the context has a cheaper copy.
+     *
+     * @tparam T Data context class of behavior tree, must be copy constructible
+     */
+    template<class T>
+    class ILookahead : public Node<T>
+    {
+    public:
+        std::size_t horizon; // Virtual ticks simulated per child
+        bool parallel;       // Simulate children concurrently
+
+        /**
+         * Attach the children to the node within the constructor using the _attach(child*) method
+         */
+        explicit ILookahead(std::size_t horizon, bool parallel = false, std::string name = "")
+            : Node<T>(nullptr, name), horizon(horizon), parallel(parallel)
+        {}
+
+        ~ILookahead() override
+        {
+            _stop_workers();
+            for (TreeSnapshot<T>* snapshot : _snapshots)
+            {
+                delete snapshot;
+            }
+        }
+
+        /**
+         * Rates the outcome of a simulation
+         * @param simulated The context after the simulation
+         * @param result The state of the child after the last simulated tick
+         * @return Higher is better
+         */
+        virtual float score(const T& simulated, NodeState result) = 0;
+
+        /**
+         * Copies the context for a simulation
+         */
+        virtual T fork(const T& context)
+        {
+            return context;
+        }
+
+        NodeState _evaluate() override
+        {
+            if (this->children.empty()) return NodeState::FAILURE;
+
+            if (_committed == nullptr || _committed->state != NodeState::RUNNING)
+                _committed = this->children[_best()];
+
+            return _committed->eval();
+        }
+
+        void _halt() override
+        {
+            Node<T>::_halt();
+            _committed = nullptr;
+        }
+
+        std::any _save() const override
+        {
+            return _committed;
+        }
+
+        void _restore(const std::any& saved) override
+        {
+            _committed = std::any_cast<Node<T>*>(saved);
+        }
+
+    private:
+        std::vector<TreeSnapshot<T>*> _snapshots; // One per child, compiled on first simulation
+        Node<T>* _committed = nullptr;            // Child chosen by the last simulation
+
+        // Workers of parallel simulation, worker i simulates child i + 1 in every round
+        std::vector<std::thread> _workers;
+        std::mutex _mutex;
+        std::condition_variable _wake;
+        std::condition_variable _done;
+        std::uint64_t _round = 0;  // Advanced to start a round
+        std::size_t _pending = 0;  // Workers still simulating in the current round
+        bool _stopping = false;
+        std::vector<float> _scores;
+        std::vector<std::exception_ptr> _errors;
+
+        float _simulate(std::size_t index)
+        {
+            Node<T>* child = this->children[index];
+            TreeSnapshot<T>& snapshot = *_snapshots[index];
+            T simulated = fork(*this->context);
+
+            snapshot.capture();
+            snapshot.bind(&simulated);
+            NodeState result = NodeState::RUNNING;
+            try
+            {
+                for (std::size_t tick = 0; tick < horizon && result == NodeState::RUNNING; tick++)
+                {
+                    result = child->eval();
+                }
+            }
+            catch (...)
+            {
+                // The nodes must not keep pointing at the simulated context
+                snapshot.restore();
+                throw;
+            }
+            snapshot.restore();
+            return score(simulated, result);
+        }
+
+        std::size_t _best()
+        {
+            const std::size_t count = this->children.size();
+            if (_snapshots.size() != count)
+            {
+                for (std::size_t i = _snapshots.size(); i < count; i++)
+                {
+                    _snapshots.push_back(new TreeSnapshot<T>(this->children[i]));
+                }
+            }
+
+            _scores.assign(count, 0.0f);
+            if (parallel && count > 1)
+            {
+                _simulate_parallel();
+            }
+            else
+            {
+                for (std::size_t i = 0; i < count; i++)
+                {
+                    _scores[i] = _simulate(i);
+                }
+            }
+
+            std::size_t best = 0;
+            for (std::size_t i = 1; i < count; i++)
+            {
+                if (_scores[i] > _scores[best]) best = i;
+            }
+            return best;
+        }
+
+        /**
+         * Simulates child 0 on this thread and the others on the workers, started on first use
+         */
+        void _simulate_parallel()
+        {
+            const std::size_t count = this->children.size();
+            if (_workers.size() != count - 1)
+            {
+                _stop_workers();
+                for (std::size_t i = 1; i < count; i++)
+                {
+                    _workers.emplace_back(&ILookahead::_work, this, i, _round);
+                }
+            }
+
+            _errors.assign(count, nullptr);
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _pending = count - 1;
+                _round++;
+            }
+            _wake.notify_all();
+
+            try
+            {
+                _scores[0] = _simulate(0);
+            }
+            catch (...)
+            {
+                _errors[0] = std::current_exception();
+            }
+
+            // Wait for the round even on errors, the workers use the snapshots
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _done.wait(lock, [this]() { return _pending == 0; });
+            }
+            for (const std::exception_ptr& error : _errors)
+            {
+                if (error) std::rethrow_exception(error);
+            }
+        }
+
+        void _work(std::size_t index, std::uint64_t round)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (true)
+            {
+                _wake.wait(lock, [this, round]() { return _stopping || _round != round; });
+                if (_stopping) return;
+                round = _round;
+                lock.unlock();
+                try
+                {
+                    _scores[index] = _simulate(index);
+                }
+                catch (...)
+                {
+                    _errors[index] = std::current_exception();
+                }
+                lock.lock();
+                if (--_pending == 0) _done.notify_one();
+            }
+        }
+
+        void _stop_workers()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stopping = true;
+            }
+            _wake.notify_all();
+            for (std::thread& worker : _workers)
+            {
+                worker.join();
+            }
+            _workers.clear();
+            _stopping = false;
+        }
+    };
+
+    /**
+     * Base class for condition leaves. Conditions do not have child nodes.
+     *
+     * Used to check whether a condition is true or false.
+     *
+     * They are similar to action leaves but should not alter the state of the system.
+     * Meaning a condition leaf is always synchronous and does not return a RUNNING state.
+     *
+     * Requires an implementation of the condition() method.
+     */
+    template<class T>
+    class IConditionLeaf : public Node<T>
+    {
+    public:
+        IConditionLeaf(std::string name = "") : Node<T>(nullptr, name){}
+
+        NodeState _evaluate() override {
+            // Condition holds
+            if (condition()) 
+                return NodeState::SUCCESS;
+            // Condition does not hold (false)
+            return NodeState::FAILURE;
+        }
+
+        NodeState _evaluate_instance(T* context, NodeState* states) override
+        {
+            (void)states;
+            // Only the leaf itself needs the context
+            this->context = context;
+            return condition() ? NodeState::SUCCESS : NodeState::FAILURE;
+        }
+
+        StatePlanes _evaluate_lanes(LaneBlock<T>& block, LaneMask active) override
+        {
+            LaneMask success = 0;
+            for (LaneMask lanes = active; lanes != 0; lanes &= lanes - 1)
+            {
+                const unsigned lane = _lowest_lane(lanes);
+                this->context = block.contexts[lane];
+                if (condition()) success |= LaneMask(1) << lane;
+            }
+            // Conditions are always done
+            return StatePlanes{active, success};
+        }
+
+        void _evaluate_wave(Wavefront<T>& wave, const std::vector<std::size_t>& agents, NodeState* states) override
+        {
+            for (std::size_t i = 0; i < agents.size(); i++)
+            {
+                this->context = wave.contexts[agents[i]];
+                states[i] = condition() ? NodeState::SUCCESS : NodeState::FAILURE;
+            }
+        }
+        /**
+         * This method describes whether the node's condition is met or not.
+         *
+         * If the method returns true, the state will be evaluated to SUCCESS.
+         * If the method returns false, the state will be evaluated to FAILURE.
+         * @return true when condition is met. False otherwise.
+         */
+        virtual bool condition() = 0;
+    };
+
+    /**
+     * How a ConditionGroup combines its predicates
+     */
+    enum class GroupMode
+    {
+        ALL,      // Holds if every predicate holds
+        ANY,      // Holds if any predicate holds
+        AT_LEAST  // Holds if at least threshold predicates hold
+    };
+
+    /**
+     * Evaluates several lightweight predicates within a single node.
+     * Replaces sequences and selectors of small condition leaves, which each cost a virtual call and a state update.
+     *
+     * Predicates are plain function pointers stored with a parameter in a compact array.
+     * Evaluation stops as soon as the result is decided.
+     *
+     * Usage:
+     *  group->_attach_predicate([](const T& context, double range) { return context.distance < range; }, 50.0);
+     *
+     * @tparam T Data context class of behavior tree
+     */
+    template<class T>
+    class ConditionGroup : public IConditionLeaf<T>
+    {
+    public:
+        typedef bool (*Predicate)(const T& context, double parameter);
+
+        GroupMode mode;        // How the predicates are combined
+        std::size_t threshold; // Predicates required to hold in AT_LEAST mode
+
+        explicit ConditionGroup(GroupMode mode = GroupMode::ALL, std::size_t threshold = 0, std::string name = "")
+            : IConditionLeaf<T>(name), mode(mode), threshold(threshold)
+        {}
+
+        /**
+         * Add a predicate. Predicates are evaluated in the order they are added.
+         */
+        void _attach_predicate(Predicate predicate, double parameter = 0.0)
+        {
+            _predicates.push_back(Entry{predicate, parameter});
+        }
+
+        bool condition() override
+        {
+            const T& context = *this->context;
+            const std::size_t count = _predicates.size();
+            switch (mode)
+            {
+            case GroupMode::ALL:
+                for (const Entry& entry : _predicates)
+                {
+                    if (!entry.predicate(context, entry.parameter)) return false;
+                }
+                return true;
+            case GroupMode::ANY:
+                for (const Entry& entry : _predicates)
+                {
+                    if (entry.predicate(context, entry.parameter)) return true;
+                }
+                return false;
+            case GroupMode::AT_LEAST:
+                break;
+            }
+
+            std::size_t holding = 0;
+            for (std::size_t i = 0; i < count; i++)
+            {
+                if (holding >= threshold) return true;
+                // Stop when the remaining predicates cannot reach the threshold
+                if (holding + (count - i) < threshold) return false;
+                if (_predicates[i].predicate(context, _predicates[i].parameter)) holding++;
+            }
+            return holding >= threshold;
+        }
+
+    private:
+        struct Entry
+        {
+            Predicate predicate;
+            double parameter;
+        };
+
+        std::vector<Entry> _predicates;
+    };
+
+    /**
+     * Comparisons for FieldCompare
+     */
+    struct Less         { template<class A, class B> static bool apply(const A& a, const B& b) { return a < b; } };
+    struct LessEqual    { template<class A, class B> static bool apply(const A& a, const B& b) { return a <= b; } };
+    struct Greater      { template<class A, class B> static bool apply(const A& a, const B& b) { return a > b; } };
+    struct GreaterEqual { template<class A, class B> static bool apply(const A& a, const B& b) { return a >= b; } };
+    struct Equal        { template<class A, class B> static bool apply(const A& a, const B& b) { return a == b; } };
+    struct NotEqual     { template<class A, class B> static bool apply(const A& a, const B& b) { return a != b; } };
+
+    /**
+     * Splits a pointer to data member into its class and field type
+     */
+    template<class M>
+    struct MemberPointer;
+
+    template<class C, class V>
+    struct MemberPointer<V C::*>
+    {
+        typedef C Class;
+        typedef V Value;
+    };
+
+    /**
+     * Base of declarative field conditions. Provides the scalar, batch and struct of arrays evaluation
+     * from a single static test, so the field condition needs no hand written leaf.
+     *
+     * @tparam Derived The field condition, must provide static bool test(const Value&)
+     * @tparam Member Pointer to the tested field of the context
+     */
+    template<class Derived, auto Member>
+    class IFieldCondition : public IConditionLeaf<typename MemberPointer<decltype(Member)>::Class>
+    {
+    public:
+        typedef typename MemberPointer<decltype(Member)>::Class Context;
+        typedef typename MemberPointer<decltype(Member)>::Value Value;
+
+        explicit IFieldCondition(std::string name = "") : IConditionLeaf<Context>(name)
+        {}
+
+        bool condition() override
+        {
+            return holds(*this->context);
+        }
+
+        StatePlanes _evaluate_lanes(LaneBlock<Context>& block, LaneMask active) override
+        {
+            return StatePlanes{active, lanes(block) & active};
+        }
+
+        void _evaluate_wave(Wavefront<Context>& wave, const std::vector<std::size_t>& agents, NodeState* states) override
+        {
+            std::vector<LaneMask> masks((agents.size() + 63) / 64);
+            wavefront(wave, agents, masks.data());
+            for (std::size_t i = 0; i < agents.size(); i++)
+            {
+                states[i] = (masks[i / 64] >> (i % 64) & 1) != 0 ? NodeState::SUCCESS : NodeState::FAILURE;
+            }
+        }
+
+        /**
+         * Tests the field of a single context
+         */
+        static bool holds(const Context& context)
+        {
+            return Derived::test(context.*Member);
+        }
+
+        /**
+         * Tests the field for every lane of a block. The field is gathered into a column first,
+         * so the comparison runs as a vector kernel.
+         */
+        static LaneMask lanes(const LaneBlock<Context>& block)
+        {
+            Value column[LaneBlock<Context>::LANES];
+            for (std::size_t lane = 0; lane < block.count; lane++)
+            {
+                column[lane] = block.contexts[lane]->*Member;
+            }
+            LaneMask mask = 0;
+            kernel(column, block.count, &mask);
+            return mask;
+        }
+
+        /**
+         * Tests the field for the agents of a wavefront. The field is gathered into a column first.
+         * @param masks Receives one bit per agent, (agents.size() + 63) / 64 masks
+         */
+        static void wavefront(const Wavefront<Context>& wave, const std::vector<std::size_t>& agents, LaneMask* masks)
+        {
+            std::vector<Value> column(agents.size());
+            for (std::size_t i = 0; i < agents.size(); i++)
+            {
+                column[i] = wave.contexts[agents[i]]->*Member;
+            }
+            kernel(column.data(), column.size(), masks);
+        }
+
+        /**
+         * Tests a struct of arrays column of the field. Written to be auto vectorized.
+         * @param column Field values of count agents
+         * @param count Number of agents
+         * @param masks Receives one bit per agent, (count + 63) / 64 masks
+         */
+        static void kernel(const Value* column, std::size_t count, LaneMask* masks)
+        {
+            for (std::size_t first = 0; first < count; first += 64)
+            {
+                const std::size_t size = std::min<std::size_t>(64, count - first);
+                const Value* values = column + first;
+                // Compare in a branch free loop, then pack the results into bits
+                std::uint8_t results[64];
+                for (std::size_t i = 0; i < size; i++)
+                {
+                    results[i] = std::uint8_t(Derived::test(values[i]));
+                }
+                LaneMask mask = 0;
+                for (std::size_t i = 0; i < size; i++)
+                {
+                    mask |= LaneMask(results[i]) << i;
+                }
+                masks[first / 64] = mask;
+            }
+        }
+    };
+
+    /**
+     * Condition leaf comparing a context field to a constant, e.g. FieldCompare<&Agent::health, Less, 30>
+     *
+     * @tparam Member Pointer to the tested field of the context
+     * @tparam Compare Less, LessEqual, Greater, GreaterEqual, Equal or NotEqual
+     * @tparam Constant The value the field is compared to
+     */
+    template<auto Member, class Compare, auto Constant>
+    class FieldCompare : public IFieldCondition<FieldCompare<Member, Compare, Constant>, Member>
+    {
+    public:
+        typedef typename MemberPointer<decltype(Member)>::Value Value;
+
+        explicit FieldCompare(std::string name = "")
+            : IFieldCondition<FieldCompare<Member, Compare, Constant>, Member>(name)
+        {}
+
+        static bool test(const Value& value)
+        {
+            return Compare::apply(value, Constant);
+        }
+    };
+
+    /**
+     * Condition leaf checking that a context field is within [Min, Max], e.g. FieldRange<&Agent::distance, 0, 50>
+     *
+     * @tparam Member Pointer to the tested field of the context
+     */
+    template<auto Member, auto Min, auto Max>
+    class FieldRange : public IFieldCondition<FieldRange<Member, Min, Max>, Member>
+    {
+    public:
+        typedef typename MemberPointer<decltype(Member)>::Value Value;
+
+        explicit FieldRange(std::string name = "")
+            : IFieldCondition<FieldRange<Member, Min, Max>, Member>(name)
+        {}
+
+        static bool test(const Value& value)
+        {
+            return Min <= value && value <= Max;
+        }
+    };
+
+    /**
+     * Condition leaf fusing several field conditions of the same context into one node.
+     * Holds if all of them hold. In batch mode their lane masks are combined without any per lane branching.
+     *
+     * Usage: FieldAll<FieldCompare<&Agent::health, Less, 30>, FieldRange<&Agent::distance, 0, 50>>
+     *
+     * @tparam First, Rest FieldCompare or FieldRange types
+     */
+    template<class First, class... Rest>
+    class FieldAll : public IConditionLeaf<typename First::Context>
+    {
+    public:
+        typedef typename First::Context Context;
+
+        explicit FieldAll(std::string name = "") : IConditionLeaf<Context>(name)
+        {}
+
+        bool condition() override
+        {
+            const Context& context = *this->context;
+            return (First::holds(context) && ... && Rest::holds(context));
+        }
+
+        StatePlanes _evaluate_lanes(LaneBlock<Context>& block, LaneMask active) override
+        {
+            return StatePlanes{active, (First::lanes(block) & ... & Rest::lanes(block)) & active};
+        }
+
+        void _evaluate_wave(Wavefront<Context>& wave, const std::vector<std::size_t>& agents, NodeState* states) override
+        {
+            const std::size_t size = (agents.size() + 63) / 64;
+            std::vector<LaneMask> masks(size);
+            std::vector<LaneMask> next(size);
+            First::wavefront(wave, agents, masks.data());
+            (_and<Rest>(wave, agents, masks, next), ...);
+            for (std::size_t i = 0; i < agents.size(); i++)
+            {
+                states[i] = (masks[i / 64] >> (i % 64) & 1) != 0 ? NodeState::SUCCESS : NodeState::FAILURE;
+            }
+        }
+
+    private:
+        /**
+         * Runs the kernel of a further condition over its own column and combines it per 64 agents
+         */
+        template<class Condition>
+        static void _and(const Wavefront<Context>& wave, const std::vector<std::size_t>& agents,
+                         std::vector<LaneMask>& masks, std::vector<LaneMask>& next)
+        {
+            Condition::wavefront(wave, agents, next.data());
+            for (std::size_t i = 0; i < masks.size(); i++)
+            {
+                masks[i] &= next[i];
+            }
+        }
+    };
+
+    /**
+     * Base class for action leaves. Actions do not have child nodes.
+     *
+     * An action leaf performs a task.
+     * The action can return in a SUCCESS, FAILURE or RUNNING state.
+     * @tparam T Data context class of behavior tree
+     */
+    template<class T>
+    class IActionLeaf : public Node<T>
+    {
+    public:
+        IActionLeaf(std::string name = ""): Node<T> (nullptr, name) {}
+
+        NodeState _evaluate() override {
+            return action();
+        }
+
+        NodeState _evaluate_instance(T* context, NodeState* states) override
+        {
+            (void)states;
+            // Only the leaf itself needs the context
+            this->context = context;
+            return action();
+        }
+
+        void _halt_instance(T* context, NodeState* states) override
+        {
+            // Let the leaf cancel its work for this agent
+            this->context = context;
+            this->_halt();
+            states[this->index] = NodeState::FAILURE;
+        }
+
+        StatePlanes _evaluate_lanes(LaneBlock<T>& block, LaneMask active) override
+        {
+            // Gather the active lanes for a single batch call
+            T* contexts[LaneBlock<T>::LANES] = {};
+            unsigned lanes[LaneBlock<T>::LANES] = {};
+            std::size_t count = 0;
+            for (LaneMask remaining = active; remaining != 0; remaining &= remaining - 1)
+            {
+                lanes[count] = _lowest_lane(remaining);
+                contexts[count] = block.contexts[lanes[count]];
+                count++;
+            }
+
+            NodeState states[LaneBlock<T>::LANES];
+            action_batch(contexts, count, states);
+
+            StatePlanes result = {0, 0};
+            for (std::size_t i = 0; i < count; i++)
+            {
+                result.set(lanes[i], states[i]);
+                if (states[i] == NodeState::RUNNING && block.running[lanes[i]] == nullptr) block.running[lanes[i]] = this;
+            }
+            return result;
+        }
+
+        void _evaluate_wave(Wavefront<T>& wave, const std::vector<std::size_t>& agents, NodeState* states) override
+        {
+            // One batch call with every agent that reached the action
+            std::vector<T*> contexts(agents.size());
+            for (std::size_t i = 0; i < agents.size(); i++)
+            {
+                contexts[i] = wave.contexts[agents[i]];
+            }
+            action_batch(contexts.data(), contexts.size(), states);
+
+            for (std::size_t i = 0; i < agents.size(); i++)
+            {
+                if (states[i] == NodeState::RUNNING && wave.running[agents[i]] == nullptr) wave.running[agents[i]] = this;
+            }
+        }
+
+        /**
+         * The task of the action node
+         * @return The state of the action at the time of returning
+         */
+        virtual NodeState action() = 0;
+
+        /**
+         * The task of the action node for many agents at once. Called in batch mode with every agent
+         * that reached the node in the evaluated block, or in the whole population in wavefront mode.
+         * Override when the task is cheaper for many agents together, e.g. a single spatial query.
+         * The default implementation calls action() for each agent.
+         *
+         * @param contexts Context of each agent
+         * @param count Number of agents
+         * @param states Receives the state of the action for each agent
+         */
+        virtual void action_batch(T* const* contexts, std::size_t count, NodeState* states)
+        {
+            for (std::size_t i = 0; i < count; i++)
+            {
+                this->context = contexts[i];
+                states[i] = action();
+            }
+        }
+    };
+
+    /**
+     * All child nodes are evaluated until a FAILURE evaluation
+     * Evaluates to SUCCESS if all children retrun success
+     * Evaluates to RUNNING if any of the children returns running
+     * Evaluates to FAILURE if any of the nodes return failure
+     */
+    template<class T>
+    class IParalellSequence : public Node<T>
+    {
+    public:
+        /**
+         * Attach the children to the node within this method. (Using _attach(child))
+         */
+        IParalellSequence(std::string name = "") : Node<T>(nullptr, name)
+        {};
+
+        NodeState _evaluate() override {
+            bool allSuccess = true;
+            // Iterate and evaluate all children
+            for (Node<T>* child : this->children)
+            {
+                // Update child state
+                child->eval();
+                // Stop iterating if the state is failure
+                if (child->state == NodeState::FAILURE) return child->state;
+                // Signal not finished if any node is running
+                if (child->state == NodeState::RUNNING) allSuccess = false;
+            }
+            // Some nodes are still running
+            if (!allSuccess) return NodeState::RUNNING;
+            // All nodes are done
+            return NodeState::SUCCESS;
+        }
+
+        NodeState _evaluate_instance(T* context, NodeState* states) override
+        {
+            bool allSuccess = true;
+            for (Node<T>* child : this->children)
+            {
+                const NodeState state = child->eval(context, states);
+                // Stop iterating if the state is failure
+                if (state == NodeState::FAILURE) return state;
+                // Signal not finished if any node is running
+                if (state == NodeState::RUNNING) allSuccess = false;
+            }
+            return allSuccess ? NodeState::SUCCESS : NodeState::RUNNING;
+        }
+
+        StatePlanes _evaluate_lanes(LaneBlock<T>& block, LaneMask active) override
+        {
+            LaneMask failed = 0;
+            LaneMask running = 0;
+            // Lanes stop at their first failing child
+            for (Node<T>* child : this->children)
+            {
+                if (active == 0) break;
+                const StatePlanes states = child->_evaluate_lanes(block, active);
+                running |= states.running(active);
+                failed |= states.failure();
+                active &= ~states.failure();
+            }
+            // Lanes without failures are done if no child is running
+            const LaneMask success = active & ~running;
+            return StatePlanes{failed | success, success};
+        }
+
+        void _evaluate_wave(Wavefront<T>& wave, const std::vector<std::size_t>& agents, NodeState* states) override
+        {
+            // Positions in agents without a failing child, and whether a child is running for them
+            std::vector<std::size_t> pending(agents.size());
+            for (std::size_t i = 0; i < pending.size(); i++)
+            {
+                pending[i] = i;
+                states[i] = NodeState::SUCCESS;
+            }
+
+            std::vector<std::size_t> reached;
+            std::vector<NodeState> results;
+            for (Node<T>* child : this->children)
+            {
+                if (pending.empty()) break;
+                reached.clear();
+                for (std::size_t position : pending) reached.push_back(agents[position]);
+                results.resize(reached.size());
+                child->_evaluate_wave(wave, reached, results.data());
+
+                std::size_t kept = 0;
+                for (std::size_t i = 0; i < pending.size(); i++)
+                {
+                    if (results[i] == NodeState::RUNNING) states[pending[i]] = NodeState::RUNNING;
+                    if (results[i] == NodeState::FAILURE) states[pending[i]] = NodeState::FAILURE;
+                    else pending[kept++] = pending[i];
+                }
+                pending.resize(kept);
+            }
+        }
+    };
+
+    /**
+     * Evaluates children until the outcome is decided by a threshold.
+     * Generalizes IParalellSequence, which equals IParallel(children.size(), 1).
+     *
+     * - Evaluates to SUCCESS as soon as successThreshold children return SUCCESS.
+     * - Evaluates to FAILURE as soon as failureThreshold children return FAILURE (0 disables this threshold),
+     *   or as soon as too many children have failed for the success threshold to be reached.
+     * - Evaluates to RUNNING otherwise.
+     *
+     * Once the outcome is decided the remaining children are not evaluated
+     * and all children that are still running get halted.
+     *
+     * @tparam T Data context class of behavior tree
+     */
+    template<class T>
+    class IParallel : public Node<T>
+    {
+    public:
+        std::size_t successThreshold; // Successful children required to succeed
+        std::size_t failureThreshold; // Failed children required to fail (0 = only when success is unreachable)
+
+        /**
+         * Attach the children to the node within the constructor using the _attach(child*) method
+         */
+        IParallel(std::size_t successThreshold, std::size_t failureThreshold = 0, std::string name = "")
+            : Node<T>(nullptr, name), successThreshold(successThreshold), failureThreshold(failureThreshold)
+        {}
+
+        /**
+         * @throws runtime_error if there are no children or a threshold cannot be reached
+         */
+        NodeState _evaluate() override
+        {
+            _check();
+            const std::size_t count = this->children.size();
+            std::size_t successes = 0;
+            std::size_t failures = 0;
+            for (Node<T>* child : this->children)
+            {
+                // Update child state
+                child->eval();
+                if (child->state == NodeState::SUCCESS) successes++;
+                else if (child->state == NodeState::FAILURE) failures++;
+
+                // Stop as soon as the outcome can no longer change
+                if (successes >= successThreshold)
+                {
+                    _halt_running();
+                    return NodeState::SUCCESS;
+                }
+                if ((failureThreshold > 0 && failures >= failureThreshold) || count - failures < successThreshold)
+                {
+                    _halt_running();
+                    return NodeState::FAILURE;
+                }
+            }
+            // Undecided, some children are still running
+            return NodeState::RUNNING;
+        }
+
+        NodeState _evaluate_instance(T* context, NodeState* states) override
+        {
+            _check();
+            const std::size_t count = this->children.size();
+            std::size_t successes = 0;
+            std::size_t failures = 0;
+            for (Node<T>* child : this->children)
+            {
+                const NodeState state = child->eval(context, states);
+                if (state == NodeState::SUCCESS) successes++;
+                else if (state == NodeState::FAILURE) failures++;
+
+                // Stop as soon as the outcome can no longer change
+                if (successes >= successThreshold)
+                {
+                    _halt_running(context, states);
+                    return NodeState::SUCCESS;
+                }
+                if ((failureThreshold > 0 && failures >= failureThreshold) || count - failures < successThreshold)
+                {
+                    _halt_running(context, states);
+                    return NodeState::FAILURE;
+                }
+            }
+            // Undecided, some children are still running
+            return NodeState::RUNNING;
+        }
+
+    private:
+        /**
+         * Thresholds are checked on evaluation, children are attached after construction
+         */
+        void _check() const
+        {
+            const std::size_t count = this->children.size();
+            if (count == 0)
+            {
+                throw std::runtime_error("Parallel '" + this->name + "' has no children");
+            }
+            if (successThreshold == 0 || successThreshold > count || failureThreshold > count)
+            {
+                throw std::runtime_error("Parallel '" + this->name + "' thresholds " +
+                                         std::to_string(successThreshold) + "/" + std::to_string(failureThreshold) +
+                                         " do not fit " + std::to_string(count) + " children");
+            }
+        }
+
+        /**
+         * Halts children still running from this or a previous tick
+         */
+        void _halt_running()
+        {
+            for (Node<T>* child : this->children)
+            {
+                if (child->state == NodeState::RUNNING) child->_halt();
+            }
+        }
+
+        void _halt_running(T* context, NodeState* states)
+        {
+            for (Node<T>* child : this->children)
+            {
+                if (states[child->index] == NodeState::RUNNING) child->_halt_instance(context, states);
+            }
+        }
+    };
+
+    template<class T>
+    class IDecorator : public Node<T> {
+    public:
+        IDecorator(Node<T>* child, std::string name = "") : Node<T>(nullptr, name)
+        {
+            // The child is kept in children as well, so context propagation, halting and destruction reach it
+            this->child = child;
+            this->_attach(child);
+        }
+
+        NodeState _evaluate() override
+        {
+            return decorate(child->eval());
+        }
+
+        NodeState _evaluate_instance(T* context, NodeState* states) override
+        {
+            const NodeState state = child->eval(context, states);
+            this->context = context;
+            return decorate(state);
+        }
+
+        StatePlanes _evaluate_lanes(LaneBlock<T>& block, LaneMask active) override
+        {
+            const StatePlanes states = child->_evaluate_lanes(block, active);
+            StatePlanes result = {0, 0};
+            for (LaneMask lanes = active; lanes != 0; lanes &= lanes - 1)
+            {
+                const unsigned lane = _lowest_lane(lanes);
+                this->context = block.contexts[lane];
+                result.set(lane, decorate(states.state(lane)));
+            }
+            return result;
+        }
+
+        void _evaluate_wave(Wavefront<T>& wave, const std::vector<std::size_t>& agents, NodeState* states) override
+        {
+            child->_evaluate_wave(wave, agents, states);
+            for (std::size_t i = 0; i < agents.size(); i++)
+            {
+                this->context = wave.contexts[agents[i]];
+                states[i] = decorate(states[i]);
+            }
+        }
+
+        virtual NodeState decorate(NodeState childEvaluation) = 0;
+
+        Node<T>* child;
+    };
+
+    template<class T>
+    class Inverter : public IDecorator<T> {
+    public:
+        Inverter(Node<T>* child) : IDecorator<T>(child, "Inverter")
+        {}
+        NodeState decorate(NodeState childEvaluation) override
+        {
+            // Invert Success and Failure states.
+            if (childEvaluation == NodeState::SUCCESS) return NodeState::FAILURE;
+            if (childEvaluation == NodeState::FAILURE) return NodeState::SUCCESS;
+            return NodeState::RUNNING;
+        }
+
+        StatePlanes _evaluate_lanes(LaneBlock<T>& block, LaneMask active) override
+        {
+            const StatePlanes states = this->child->_evaluate_lanes(block, active);
+            return StatePlanes{states.done, states.failure()};
+        }
+    };
+
+    /**
+     * Blocks its child for a duration after the child finished.
+     *
+     * - Evaluates to FAILURE without evaluating the child while cooling down.
+     * - Otherwise evaluates the child and returns its state.
+     *   The cooldown starts when the child returns SUCCESS or FAILURE, or when it is halted while RUNNING.
+     *
+     * @tparam T Data context class of behavior tree
+     */
+    template<class T>
+    class Cooldown : public IDecorator<T>
+    {
+    public:
+        /**
+         * @param child The decorated node
+         * @param clock Time source, not owned
+         * @param duration Time the child is blocked after it finished
+         */
+        Cooldown(Node<T>* child, const Clock& clock, Clock::Duration duration)
+            : IDecorator<T>(child, "Cooldown"), _clock(clock), _duration(duration)
+        {}
+
+        NodeState _evaluate() override
+        {
+            if (_cooling && _clock.now() < _until) return NodeState::FAILURE;
+            _cooling = false;
+
+            const NodeState state = this->child->eval();
+            if (state != NodeState::RUNNING) _start();
+            return decorate(state);
+        }
+
+        NodeState decorate(NodeState childEvaluation) override
+        {
+            return childEvaluation;
+        }
+
+        // The timer is kept in _evaluate, so every mode evaluates through it rather than through decorate()
+        NodeState _evaluate_instance(T* context, NodeState* states) override
+        {
+            return Node<T>::_evaluate_instance(context, states);
+        }
+
+        StatePlanes _evaluate_lanes(LaneBlock<T>& block, LaneMask active) override
+        {
+            return Node<T>::_evaluate_lanes(block, active);
+        }
+
+        void _evaluate_wave(Wavefront<T>& wave, const std::vector<std::size_t>& agents, NodeState* states) override
+        {
+            Node<T>::_evaluate_wave(wave, agents, states);
+        }
+
+        void _halt() override
+        {
+            if (this->child->state == NodeState::RUNNING) _start();
+            Node<T>::_halt();
+        }
+
+        std::any _save() const override
+        {
+            return std::make_pair(_cooling, _until);
+        }
+
+        void _restore(const std::any& saved) override
+        {
+            const auto& members = std::any_cast<const std::pair<bool, Clock::Duration>&>(saved);
+            _cooling = members.first;
+            _until = members.second;
+        }
+
+    private:
+        const Clock& _clock;
+        Clock::Duration _duration;
+        Clock::Duration _until{0};
+        bool _cooling = false;
+
+        void _start()
+        {
+            _cooling = true;
+            _until = _clock.now() + _duration;
+        }
+    };
+
+    /**
+     * Fails its child if it keeps RUNNING for too long.
+     *
+     * - Evaluates the child and returns its state.
+     * - Once the child has been RUNNING for the time limit since it started, halts it and evaluates to FAILURE.
+     *
+     * @tparam T Data context class of behavior tree
+     */
+    template<class T>
+    class Timeout : public IDecorator<T>
+    {
+    public:
+        /**
+         * @param child The decorated node
+         * @param clock Time source, not owned
+         * @param limit Time the child may stay RUNNING
+         */
+        Timeout(Node<T>* child, const Clock& clock, Clock::Duration limit)
+            : IDecorator<T>(child, "Timeout"), _clock(clock), _limit(limit)
+        {}
+
+        NodeState _evaluate() override
+        {
+            if (this->child->state != NodeState::RUNNING) _started = _clock.now();
+
+            const NodeState state = this->child->eval();
+            if (state == NodeState::RUNNING && _clock.now() - _started >= _limit)
+            {
+                this->child->_halt();
+                return NodeState::FAILURE;
+            }
+            return decorate(state);
+        }
+
+        NodeState decorate(NodeState childEvaluation) override
+        {
+            return childEvaluation;
+        }
+
+        // The timer is kept in _evaluate, so every mode evaluates through it rather than through decorate()
+        NodeState _evaluate_instance(T* context, NodeState* states) override
+        {
+            return Node<T>::_evaluate_instance(context, states);
+        }
+
+        StatePlanes _evaluate_lanes(LaneBlock<T>& block, LaneMask active) override
+        {
+            return Node<T>::_evaluate_lanes(block, active);
+        }
+
+        void _evaluate_wave(Wavefront<T>& wave, const std::vector<std::size_t>& agents, NodeState* states) override
+        {
+            Node<T>::_evaluate_wave(wave, agents, states);
+        }
+
+        std::any _save() const override
+        {
+            return _started;
+        }
+
+        void _restore(const std::any& saved) override
+        {
+            _started = std::any_cast<Clock::Duration>(saved);
+        }
+
+    private:
+        const Clock& _clock;
+        Clock::Duration _limit;
+        Clock::Duration _started{0}; // Start of the current run of the child
+    };
+
+    /**
+     * Waits for a duration.
+     *
+     * - Evaluates to RUNNING until the duration passed since the wait started, then to SUCCESS.
+     * - A wait starts on the first evaluation after it succeeded or was halted.
+     *
+     * @tparam T Data context class of behavior tree
+     */
+    template<class T>
+    class Wait : public Node<T>
+    {
+    public:
+        /**
+         * @param clock Time source, not owned
+         * @param duration Time to wait
+         */
+        Wait(const Clock& clock, Clock::Duration duration)
+            : Node<T>(nullptr, "Wait"), _clock(clock), _duration(duration)
+        {}
+
+        NodeState _evaluate() override
+        {
+            if (this->state != NodeState::RUNNING) _until = _clock.now() + _duration;
+            return _clock.now() >= _until ? NodeState::SUCCESS : NodeState::RUNNING;
+        }
+
+        std::any _save() const override
+        {
+            return _until;
+        }
+
+        void _restore(const std::any& saved) override
+        {
+            _until = std::any_cast<Clock::Duration>(saved);
+        }
+
+    private:
+        const Clock& _clock;
+        Clock::Duration _duration;
+        Clock::Duration _until{0};
+    };
+
+    template<class T>
+    class SubtreeLibrary;
+
+    /**
+     * References a tree defined once in a SubtreeLibrary by its ID.
+     *
+     * All references to the same ID share the node structure of the definition, which is not copied.
+     * Every reference placed in a caller tree owns its own runtime state slice (one NodeState per node of
+     * the definition), which is bound to the shared nodes together with the caller's context while the
+     * reference is evaluated. References nested inside library definitions are bound by the reference enclosing
+     * them to their own range of its slice, so a definition may reference the same ID more than once.
+     *
+     * The ID is resolved to a direct pointer at load time with SubtreeLibrary::resolve(tree).
+     * Only the NodeState of shared nodes is part of the slice. Nodes that keep additional runtime members
+     * should not be placed in a shared definition.
+     *
+     * @tparam T Data context class of behavior tree
+     */
+    template<class T>
+    class SubtreeRef : public Node<T>
+    {
+        friend class SubtreeLibrary<T>;
+
+    public:
+        std::string id; // ID of the referenced definition
+
+        explicit SubtreeRef(std::string id, std::string name = "") : Node<T>(nullptr, name.empty() ? id : name)
+        {
+            this->id = id;
+        }
+
+        /**
+         * @return The shared root node of the referenced definition, nullptr if not resolved
+         */
+        Node<T>* target() const { return _target; }
+
+        NodeState _evaluate() override
+        {
+            if (_target == nullptr)
+                throw std::runtime_error("Subtree '" + id + "' not resolved");
+
+            // Nested references reached without their enclosing reference binding them, as in batch mode
+            if (_states() == nullptr) return _target->eval();
+
+            _bind();
+            NodeState result = _target->eval();
+            _store();
+            return result;
+        }
+
+        void _propagate_context() override
+        {
+            // The context is bound to the shared nodes on evaluation, except through nested references,
+            // which batch mode reaches without an outermost reference binding them
+            if (!_owning && _target != nullptr)
+            {
+                _target->context = this->context;
+                _target->_propagate_context();
+            }
+        }
+
+        StatePlanes _evaluate_lanes(LaneBlock<T>& block, LaneMask active) override
+        {
+            if (_target == nullptr)
+                throw std::runtime_error("Subtree '" + id + "' not resolved");
+            // Lanes carry their own contexts, the shared nodes are used directly
+            return _target->_evaluate_lanes(block, active);
+        }
+
+        void _evaluate_wave(Wavefront<T>& wave, const std::vector<std::size_t>& agents, NodeState* states) override
+        {
+            if (_target == nullptr)
+                throw std::runtime_error("Subtree '" + id + "' not resolved");
+            _target->_evaluate_wave(wave, agents, states);
+        }
+
+        NodeState _evaluate_instance(T* context, NodeState* states) override
+        {
+            if (_target == nullptr)
+                throw std::runtime_error("Subtree '" + id + "' not resolved");
+            // The definition's states follow this reference's own state
+            return _target->eval(context, states + _offset);
+        }
+
+        void _halt_instance(T* context, NodeState* states) override
+        {
+            if (_target != nullptr && states[_offset + _target->index] == NodeState::RUNNING)
+                _target->_halt_instance(context, states + _offset);
+            states[this->index] = NodeState::FAILURE;
+        }
+
+        void _number(std::size_t& next) override
+        {
+            if (_target == nullptr)
+                throw std::runtime_error("Subtree '" + id + "' not resolved");
+            this->index = next++;
+            _offset = next;
+            next += _size;
+        }
+
+        void _collect(std::vector<Node<T>*>& nodes) override
+        {
+            nodes.push_back(this);
+            if (_target != nullptr) _target->_collect(nodes);
+        }
+
+        void _halt() override
+        {
+            if (_target != nullptr && _states() != nullptr)
+            {
+                _bind();
+                _target->_halt();
+                _store();
+            }
+            else if (_target != nullptr)
+            {
+                _target->_halt();
+            }
+            this->state = NodeState::FAILURE;
+        }
+
+        std::any _save() const override
+        {
+            return _slice;
+        }
+
+        void _restore(const std::any& saved) override
+        {
+            _slice = std::any_cast<const std::vector<NodeState>&>(saved);
+        }
+
+    private:
+        Node<T>* _target = nullptr;                                // Shared root of the definition
+        const std::vector<Node<T>*>* _nodes = nullptr;             // Nodes of the definition, without nested ones
+        const std::vector<SubtreeRef<T>*>* _references = nullptr;  // References nested in the definition
+        bool _owning = false;                   // Placed in a caller tree rather than in a definition
+        std::vector<NodeState> _slice;          // Runtime state owned by this reference, by index in the definition
+        NodeState* _enclosing = nullptr;        // Slice range of the enclosing definition while it is bound
+        std::size_t _size = 0;                  // States of the definition, see eval(context, states)
+        std::size_t _offset = 0;                // Position of the definition's states
+
+        /**
+         * @return States of the definition's nodes, nullptr for a nested reference that is not bound
+         */
+        NodeState* _states()
+        {
+            if (_owning) return _slice.data();
+            return _enclosing == nullptr ? nullptr : _enclosing + _offset;
+        }
+
+        /**
+         * Loads this reference's context and states into the shared nodes,
+         * and gives nested references their range of the states
+         */
+        void _bind()
+        {
+            NodeState* states = _states();
+            for (Node<T>* node : *_nodes)
+            {
+                node->context = this->context;
+                node->state = states[node->index];
+                if (this->DEBUG) node->DEBUG = true;
+            }
+            for (SubtreeRef<T>* reference : *_references)
+            {
+                reference->_enclosing = states;
+            }
+        }
+
+        /**
+         * Saves the state of the shared nodes back into this reference's states
+         */
+        void _store()
+        {
+            NodeState* states = _states();
+            for (Node<T>* node : *_nodes)
+            {
+                states[node->index] = node->state;
+            }
+            for (SubtreeRef<T>* reference : *_references)
+            {
+                reference->_enclosing = nullptr;
+            }
+        }
+    };
+
+    /**
+     * Owns subtree definitions that can be shared across trees through SubtreeRef nodes.
+     *
+     * Usage:
+     *  library.add("patrol", new Patrol());
+     *  Node<T>* tree = new Guard(); // Contains new SubtreeRef<T>("patrol")
+     *  library.resolve(tree);
+     *  BehaviorTree<T> behaviorTree(&context, tree);
+     *
+     * @tparam T Data context class of behavior tree
+     */
+    template<class T>
+    class SubtreeLibrary
+    {
+    public:
+        SubtreeLibrary() = default;
+        SubtreeLibrary(const SubtreeLibrary&) = delete;
+        SubtreeLibrary& operator=(const SubtreeLibrary&) = delete;
+
+        /**
+         * Destroys all definitions. Trees referencing them must not be evaluated afterwards.
+         */
+        ~SubtreeLibrary()
+        {
+            for (auto& entry : _definitions)
+            {
+                delete entry.second.root;
+            }
+        }
+
+        /**
+         * Add a definition. The library takes ownership of the tree.
+         * @throws runtime_error if the ID is already defined
+         */
+        void add(const std::string& id, Node<T>* tree)
+        {
+            if (_definitions.count(id) != 0)
+                throw std::runtime_error("Subtree '" + id + "' already defined");
+            _definitions[id].root = tree;
+        }
+
+        /**
+         * @return The root of the definition with the given ID, nullptr if not defined
+         */
+        Node<T>* get(const std::string& id)
+        {
+            auto it = _definitions.find(id);
+            return it == _definitions.end() ? nullptr : it->second.root;
+        }
+
+        /**
+         * Resolves all references in the tree to direct pointers and gives each its own state slice.
+         * Call once after the tree is constructed and before it is evaluated.
+         * @throws runtime_error if a referenced ID is not defined or definitions reference themselves
+         */
+        void resolve(Node<T>* tree)
+        {
+            _link(tree, true);
+        }
+
+    private:
+        struct Definition
+        {
+            Node<T>* root = nullptr;
+            std::vector<Node<T>*> nodes;            // Compiled pre-order node list without the nested definitions
+            std::vector<SubtreeRef<T>*> references; // References nested in the definition
+            std::size_t size = 0;                   // States of the definition, numbered from 0
+            bool linking = false;
+            bool linked = false;
+        };
+
+        std::unordered_map<std::string, Definition> _definitions;
+
+        Definition& _definition(const std::string& id)
+        {
+            auto it = _definitions.find(id);
+            if (it == _definitions.end())
+                throw std::runtime_error("Subtree '" + id + "' not defined");
+
+            Definition& definition = it->second;
+            if (definition.linking)
+                throw std::runtime_error("Subtree '" + id + "' references itself");
+            if (!definition.linked)
+            {
+                definition.linking = true;
+                _link(definition.root, false);
+                _compile(definition.root, definition);
+                definition.root->_number(definition.size);
+                definition.linking = false;
+                definition.linked = true;
+            }
+            return definition;
+        }
+
+        void _link(Node<T>* node, bool owning)
+        {
+            SubtreeRef<T>* reference = dynamic_cast<SubtreeRef<T>*>(node);
+            if (reference != nullptr)
+            {
+                Definition& definition = _definition(reference->id);
+                reference->_target = definition.root;
+                reference->_nodes = &definition.nodes;
+                reference->_references = &definition.references;
+                reference->_owning = owning;
+                reference->_size = definition.size;
+                reference->_slice.assign(owning ? definition.size : 0, NodeState::FAILURE);
+                return;
+            }
+            for (Node<T>* child : node->children)
+            {
+                _link(child, owning);
+            }
+        }
+
+        /**
+         * Lists the nodes of a definition in pre-order, stopping at nested references
+         */
+        void _compile(Node<T>* node, Definition& definition)
+        {
+            definition.nodes.push_back(node);
+            SubtreeRef<T>* reference = dynamic_cast<SubtreeRef<T>*>(node);
+            if (reference != nullptr)
+            {
+                definition.references.push_back(reference);
+                return;
+            }
+            for (Node<T>* child : node->children)
+            {
+                _compile(child, definition);
+            }
+        }
+    };
+
+    /**
+     * Condition leaf that holds only in ticks in which a matching event was delivered on its channel.
+     * Replaces conditions polling the context for rare events, like "was I hit this frame?".
+     *
+     * The node is notified by the channel on delivery, so evaluating it does not scan the events.
+     * The last matching event stays available through event() for the nodes that react to it.
+     *
+     * The node keeps one received event, and the match filter sees the context bound to the node at delivery.
+     * When one tree serves many agents (Update(context, states) or a Population), an event therefore counts for
+     * every agent of the tick: use such trees for broadcast events without a match filter.
+     *
+     * @tparam T Data context class of behavior tree
+     * @tparam E Event type
+     */
+    template<class T, class E>
+    class OnEvent : public IConditionLeaf<T>, public IEventSubscriber<E>
+    {
+    public:
+        /**
+         * @param channel The channel to subscribe to, e.g. events.channel<E>() of the bus passed to the BehaviorTree
+         * @param match Filters events for this node's context. Every event matches if empty.
+         */
+        explicit OnEvent(EventChannel<E>& channel, std::function<bool(T*, const E&)> match = nullptr, std::string name = "")
+            : IConditionLeaf<T>(name), _channel(channel), _match(std::move(match))
+        {
+            _channel.subscribe(this);
+        }
+
+        ~OnEvent() override
+        {
+            _channel.unsubscribe(this);
+        }
+
+        void notify(const E& event) override
+        {
+            if (_match && !_match(this->context, event)) return;
+            _event = event;
+            _batch = _channel.batch();
+            _received = true;
+        }
+
+        bool condition() override
+        {
+            return _received && _batch == _channel.batch();
+        }
+
+        /**
+         * @return The last matching event, only valid after the condition held once
+         */
+        const E& event() const { return _event; }
+
+    private:
+        EventChannel<E>& _channel;
+        std::function<bool(T*, const E&)> _match;
+        E _event{};
+        std::uint64_t _batch = 0;  // Delivery the last matching event arrived in
+        bool _received = false;
+    };
+
+    /**
+     * A group of agents evaluating shared subtrees together, e.g. a squad.
+     * Results of ISharedEvaluation nodes are cached in the group until the next tick,
+     * or until the membership or the group's data changes.
+     */
+    class SharedGroup
+    {
+    public:
+        SharedGroup() = default;
+        SharedGroup(const SharedGroup&) = delete;
+        SharedGroup& operator=(const SharedGroup&) = delete;
+
+        void join()
+        {
+            _members++;
+            _version++;
+        }
+
+        void leave()
+        {
+            _members--;
+            _version++;
+        }
+
+        /**
+         * Call when data read by the shared subtrees changes
+         */
+        void touch()
+        {
+            _version++;
+        }
+
+        std::size_t members() const { return _members; }
+
+        /**
+         * @return Changes of membership and data so far
+         */
+        std::uint64_t version() const { return _version; }
+
+        /**
+         * Looks up the cached result of a shared subtree
+         * @return true if the result of slot is cached for the tick and the current version
+         */
+        bool cached(std::size_t slot, std::uint64_t tick, NodeState& state) const
+        {
+            if (slot >= _results.size()) return false;
+            const Result& result = _results[slot];
+            if (!result.valid || result.tick != tick || result.version != _version) return false;
+            state = result.state;
+            return true;
+        }
+
+        /**
+         * Caches the result of a shared subtree for the tick and the current version
+         */
+        void cache(std::size_t slot, std::uint64_t tick, NodeState state)
+        {
+            if (slot >= _results.size()) _results.resize(slot + 1);
+            _results[slot] = Result{tick, _version, state, true};
+        }
+
+    private:
+        struct Result
+        {
+            std::uint64_t tick = 0;
+            std::uint64_t version = 0;
+            NodeState state = NodeState::FAILURE;
+            bool valid = false;
+        };
+
+        std::size_t _members = 0;
+        std::uint64_t _version = 0;
+        std::vector<Result> _results; // Cached result per shared subtree slot
+    };
+
+    /**
+     * Evaluates its child once per group and tick, and returns the cached result to the other members of the group.
+     * Use for subtrees that only depend on group level data, e.g. squad tactics.
+     *
+     * The child is evaluated with the context of the first member reaching the node in a tick,
+     * so its actions only run once for the whole group.
+     * The cached result is dropped when the tick counter advances, or the group's membership or data changes.
+     *
+     * Requires an implementation of the group() method.
+     *
+     * @tparam T Data context class of behavior tree
+     */
+    template<class T>
+    class ISharedEvaluation : public Node<T>
+    {
+    public:
+        const std::size_t slot; // Identifies the subtree within the group
+
+        /**
+         * @param child The shared subtree
+         * @param slot Identifies the subtree within the group. Nodes of different agents' trees evaluating the
+         *             same subtree must use the same slot.
+         * @param tick Tick counter of the application, advanced once per tick. Must outlive the node.
+         */
+        ISharedEvaluation(Node<T>* child, std::size_t slot, const std::uint64_t& tick, std::string name = "")
+            : Node<T>(nullptr, name), slot(slot), _tick(tick)
+        {
+            this->_attach(child);
+        }
+
+        /**
+         * @return The group of the agent, nullptr to evaluate the child for the agent alone
+         */
+        virtual SharedGroup* group() = 0;
+
+        NodeState _evaluate() override
+        {
+            SharedGroup* shared = group();
+            if (shared == nullptr) return this->children[0]->eval();
+
+            NodeState state;
+            if (shared->cached(slot, _tick, state)) return state;
+
+            state = this->children[0]->eval();
+            shared->cache(slot, _tick, state);
+            return state;
+        }
+
+    private:
+        const std::uint64_t& _tick;
+    };
+
+    /**
+     * Evaluates its child once per class of agents with equal inputs in batch mode, and gives every agent
+     * of the class the result. Use for subtrees that are a pure function of a few declared inputs,
+     * e.g. crowd behaviors reading a handful of quantized values.
+     *
+     * Agents are grouped by the hash of their inputs. Agents whose hashes collide are compared with ==,
+     * so only agents with equal inputs share a result. The child is evaluated with the context of
+     * the first agent of each class, so its actions only run for that agent. In lanes mode the results
+     * are kept for the whole Population update, so a class spanning several blocks is evaluated once
+     * each time its agents reach the node.
+     * Outside of batch mode the child is evaluated for every agent.
+     *
+     * Requires an implementation of the inputs() method.
+     *
+     * @tparam T Data context class of behavior tree
+     * @tparam Inputs The inputs of the subtree, must be equality comparable and hashable with std::hash
+     */
+    template<class T, class Inputs>
+    class IEquivalenceClasses : public Node<T>
+    {
+    public:
+        explicit IEquivalenceClasses(Node<T>* child, std::string name = "") : Node<T>(nullptr, name)
+        {
+            this->_attach(child);
+        }
+
+        /**
+         * Reads every input of the subtree from the context
+         */
+        virtual Inputs inputs() = 0;
+
+        NodeState _evaluate() override
+        {
+            return this->children[0]->eval();
+        }
+
+        NodeState _evaluate_instance(T* context, NodeState* states) override
+        {
+            return this->children[0]->eval(context, states);
+        }
+
+        StatePlanes _evaluate_lanes(LaneBlock<T>& block, LaneMask active) override
+        {
+            // Results of the classes seen by earlier blocks of the update are reused
+            if (block.tick != _tick)
+            {
+                for (auto& results : _results) results.clear();
+                _passes.clear();
+                _tick = block.tick;
+            }
+
+            // Class of each lane, identified by its first lane. Agents reaching the node again in the update,
+            // e.g. through two references to a shared definition, are classed with the others of their pass.
+            unsigned representative[LaneBlock<T>::LANES] = {};
+            Result known[LaneBlock<T>::LANES] = {};
+            LaneMask cached = 0;
+            LaneMask representatives = 0;
+            std::vector<std::unordered_map<Inputs, unsigned>> classes;
+            for (LaneMask lanes = active; lanes != 0; lanes &= lanes - 1)
+            {
+                const unsigned lane = _lowest_lane(lanes);
+                const std::size_t pass = _passes[block.contexts[lane]]++;
+                if (pass >= _results.size()) _results.resize(pass + 1);
+                if (pass >= classes.size()) classes.resize(pass + 1);
+
+                this->context = block.contexts[lane];
+                Inputs key = inputs();
+                auto found = _results[pass].find(key);
+                if (found != _results[pass].end())
+                {
+                    known[lane] = found->second;
+                    cached |= LaneMask(1) << lane;
+                    continue;
+                }
+                auto inserted = classes[pass].emplace(std::move(key), lane);
+                representative[lane] = inserted.first->second;
+                if (inserted.second) representatives |= LaneMask(1) << lane;
+            }
+
+            const StatePlanes states = representatives != 0
+                ? this->children[0]->_evaluate_lanes(block, representatives) : StatePlanes{0, 0};
+            for (std::size_t pass = 0; pass < classes.size(); pass++)
+            {
+                for (const auto& entry : classes[pass])
+                {
+                    const unsigned lane = entry.second;
+                    _results[pass].emplace(entry.first, Result{states.state(lane), block.running[lane]});
+                }
+            }
+
+            StatePlanes result = {0, 0};
+            for (LaneMask lanes = active; lanes != 0; lanes &= lanes - 1)
+            {
+                const unsigned lane = _lowest_lane(lanes);
+                const Result shared = (cached >> lane & 1) != 0 ? known[lane]
+                    : Result{states.state(representative[lane]), block.running[representative[lane]]};
+                result.set(lane, shared.state);
+                if (shared.state == NodeState::RUNNING && block.running[lane] == nullptr)
+                    block.running[lane] = shared.running;
+            }
+            return result;
+        }
+
+        void _evaluate_wave(Wavefront<T>& wave, const std::vector<std::size_t>& agents, NodeState* states) override
+        {
+            // Class of each agent as a position in representatives
+            std::vector<std::size_t> classOf(agents.size());
+            std::vector<std::size_t> representatives;
+            std::unordered_map<Inputs, std::size_t> classes;
+            for (std::size_t i = 0; i < agents.size(); i++)
+            {
+                this->context = wave.contexts[agents[i]];
+                auto inserted = classes.emplace(inputs(), representatives.size());
+                if (inserted.second) representatives.push_back(agents[i]);
+                classOf[i] = inserted.first->second;
+            }
+
+            std::vector<NodeState> results(representatives.size());
+            this->children[0]->_evaluate_wave(wave, representatives, results.data());
+            for (std::size_t i = 0; i < agents.size(); i++)
+            {
+                states[i] = results[classOf[i]];
+                if (states[i] == NodeState::RUNNING && wave.running[agents[i]] == nullptr)
+                    wave.running[agents[i]] = wave.running[representatives[classOf[i]]];
+            }
+        }
+
+    private:
+        struct Result
+        {
+            NodeState state;
+            Node<T>* running;
+        };
+
+        // Result of every class evaluated in the current update, across blocks, by pass of the agents
+        std::vector<std::unordered_map<Inputs, Result>> _results;
+        std::unordered_map<T*, std::size_t> _passes; // Times each agent reached the node in the update
+        std::uint64_t _tick = 0;
+    };
+
+    /**
+     * A spatial query around a position, e.g. "enemies within radius"
+     */
+    struct SpatialQuery
+    {
+        float x, y, z;
+        float radius;
+        std::uint32_t filter; // Application defined, e.g. a mask of entity types
+    };
+
+    /**
+     * Caches the results of spatial queries within a tick, so nearby agents issuing similar queries share one result.
+     *
+     * Queries are quantized before lookup: the position to the center of its cell and the radius up to the next
+     * radius step. The query is run with the quantized values, so the result does not depend on which agent
+     * asked first. Condition leaves reach the cache through their context.
+     *
+     * Thread safe: threads get shards in the order they first query and store their results in their own shard.
+     * With more threads than shards, threads share shards. A lookup checks the own shard first, then every other
+     * shard, each under its mutex, so a miss locks every shard once. clear() must be called at the start of each
+     * tick, while no thread is querying.
+     *
+     * @tparam Result Result of a query
+     */
+    template<class Result>
+    class SpatialQueryCache
+    {
+    public:
+        /**
+         * @param cellSize Size of the cells positions are quantized to
+         * @param radiusStep Step radii are rounded up to
+         * @param shards Number of shards, at least the number of querying threads so none share one
+         */
+        explicit SpatialQueryCache(float cellSize = 1.0f, float radiusStep = 1.0f, std::size_t shards = 16)
+            : _cellSize(cellSize), _radiusStep(radiusStep)
+        {
+            for (std::size_t i = 0; i < shards; i++)
+            {
+                _shards.emplace_back(new Shard());
+            }
+        }
+
+        /**
+         * @param query The query of the agent
+         * @param run Runs a quantized query against the world, called as Result run(const SpatialQuery&)
+         * @return The cached result, valid until clear()
+         */
+        template<class Run>
+        const Result& query(const SpatialQuery& query, Run run)
+        {
+            const Key key = {
+                std::int32_t(std::floor(query.x / _cellSize)),
+                std::int32_t(std::floor(query.y / _cellSize)),
+                std::int32_t(std::floor(query.z / _cellSize)),
+                std::int32_t(std::ceil(query.radius / _radiusStep)),
+                query.filter
+            };
+
+            // Own shard first, then the results of other threads
+            const std::size_t own = _thread() % _shards.size();
+            for (std::size_t i = 0; i < _shards.size(); i++)
+            {
+                Shard& shard = *_shards[(own + i) % _shards.size()];
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                auto found = shard.results.find(key);
+                if (found != shard.results.end()) return found->second;
+            }
+
+            const SpatialQuery quantized = {
+                (float(key.x) + 0.5f) * _cellSize,
+                (float(key.y) + 0.5f) * _cellSize,
+                (float(key.z) + 0.5f) * _cellSize,
+                float(key.radius) * _radiusStep,
+                key.filter
+            };
+            Result result = run(quantized);
+
+            Shard& shard = *_shards[own];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            // Elements of unordered maps keep their address, the reference stays valid until clear()
+            return shard.results.emplace(key, std::move(result)).first->second;
+        }
+
+        /**
+         * Drops all results. Call at the start of each tick.
+         */
+        void clear()
+        {
+            for (auto& shard : _shards)
+            {
+                std::lock_guard<std::mutex> lock(shard->mutex);
+                shard->results.clear();
+            }
+        }
+
+    private:
+        struct Key
+        {
+            std::int32_t x, y, z;
+            std::int32_t radius;
+            std::uint32_t filter;
+
+            bool operator==(const Key& other) const
+            {
+                return x == other.x && y == other.y && z == other.z && radius == other.radius && filter == other.filter;
+            }
+        };
+
+        struct KeyHash
+        {
+            std::size_t operator()(const Key& key) const
+            {
+                std::uint64_t hash = std::uint32_t(key.x);
+                hash = hash * 0x9E3779B97F4A7C15ull + std::uint32_t(key.y);
+                hash = hash * 0x9E3779B97F4A7C15ull + std::uint32_t(key.z);
+                hash = hash * 0x9E3779B97F4A7C15ull + std::uint32_t(key.radius);
+                hash = hash * 0x9E3779B97F4A7C15ull + key.filter;
+                return std::size_t(hash ^ (hash >> 32));
+            }
+        };
+
+        struct Shard
+        {
+            std::mutex mutex;
+            std::unordered_map<Key, Result, KeyHash> results;
+        };
+
+        float _cellSize;
+        float _radiusStep;
+        std::vector<std::unique_ptr<Shard>> _shards;
+
+        /**
+         * @return Index of the calling thread, in the order threads first query
+         */
+        static std::size_t _thread()
+        {
+            static std::atomic<std::size_t> next{0};
+            thread_local const std::size_t index = next++;
+            return index;
+        }
+    };
+
+    /**
+     * Interleaves the low 21 bits of each coordinate into a Morton (Z-order) key.
+     * Positions close in space get close keys, sorting by key groups agents by area.
+     */
+    inline std::uint64_t mortonKey(std::uint32_t x, std::uint32_t y, std::uint32_t z)
+    {
+        const auto spread = [](std::uint64_t v) {
+            v &= 0x1FFFFF;
+            v = (v | v << 32) & 0x1F00000000FFFFull;
+            v = (v | v << 16) & 0x1F0000FF0000FFull;
+            v = (v | v << 8) & 0x100F00F00F00F00Full;
+            v = (v | v << 4) & 0x10C30C30C30C30C3ull;
+            v = (v | v << 2) & 0x1249249249249249ull;
+            return v;
+        };
+        return spread(x) | spread(y) << 1 | spread(z) << 2;
+    }
+
+    /**
+     * Interleaves the bits of both coordinates into a Morton (Z-order) key
+     */
+    inline std::uint64_t mortonKey(std::uint32_t x, std::uint32_t y)
+    {
+        const auto spread = [](std::uint64_t v) {
+            v = (v | v << 16) & 0x0000FFFF0000FFFFull;
+            v = (v | v << 8) & 0x00FF00FF00FF00FFull;
+            v = (v | v << 4) & 0x0F0F0F0F0F0F0F0Full;
+            v = (v | v << 2) & 0x3333333333333333ull;
+            v = (v | v << 1) & 0x5555555555555555ull;
+            return v;
+        };
+        return spread(x) | spread(y) << 1;
+    }
+
+    /**
+     * How a Population schedules the evaluation of its agents
+     */
+    enum class BatchSchedule
+    {
+        LANES,    // Evaluate the tree depth first for blocks of 64 agents, combining lanes with bit operations
+        WAVEFRONT // Evaluate the tree node by node, each node processing every agent that reached it
+    };
+
+    /**
+     * Ticks many agents that share one tree in batch mode.
+     * Agents are evaluated in blocks of 64 lanes: branches combine the results of their children with bitwise
+     * operations on lane masks, and stop as soon as no lane of the block is left to evaluate.
+     *
+     * The tree is shared by all agents, so its nodes must not keep per agent runtime state between ticks.
+     * Nodes that do (IStateMachine, IPlannerAction, ILookahead, ISwitchBranch, IDecisionTable, IObserverSelector,
+     * the timers of Cooldown, Timeout and Wait, and nodes relying on the state of their children across ticks)
+     * need a BehaviorTree per agent instead.
+     *
+     * @tparam T Data context class of behavior tree
+     */
+    template<class T>
+    class Population
+    {
+    public:
+        /**
+         * @param tree The tree evaluated for every agent. The population takes ownership.
+         */
+        explicit Population(Node<T>* tree) : _tree(tree)
+        {}
+
+        Population(const Population&) = delete;
+        Population& operator=(const Population&) = delete;
+
+        ~Population()
+        {
+            delete _tree;
+        }
+
+        /**
+         * Add an agent. The context is not owned.
+         * @return Index of the agent
+         */
+        std::size_t add(T* context)
+        {
+            const std::size_t agent = _agents.size();
+            _agents.push_back(context);
+            if (agent % LaneBlock<T>::LANES == 0) _states.push_back(StatePlanes{0, 0});
+            _set_state(agent, NodeState::FAILURE);
+            _leaves.push_back(nullptr);
+            _positions.push_back(0);
+            _bucket(agent, nullptr);
+            return agent;
+        }
+
+        /**
+         * Remove an agent. The last agent takes its index.
+         */
+        void remove(std::size_t agent)
+        {
+            const std::size_t last = _agents.size() - 1;
+            _unbucket(agent);
+            if (agent != last)
+            {
+                Node<T>* leaf = _leaves[last];
+                _unbucket(last);
+                _agents[agent] = _agents[last];
+                _set_state(agent, state(last));
+                _bucket(agent, leaf);
+            }
+            _agents.pop_back();
+            if (last % LaneBlock<T>::LANES == 0) _states.pop_back();
+            _leaves.pop_back();
+            _positions.pop_back();
+        }
+
+        /**
+         * Process agents grouped by the node they were RUNNING in on the last tick, instead of by index.
+         * Agents executing the same action are evaluated back to back, which keeps its code and data hot.
+         * The groups are maintained incrementally as agents move between nodes.
+         */
+        void setCoherent(bool coherent)
+        {
+            _coherent = coherent;
+        }
+
+        /**
+         * Choose how agents are scheduled. In wavefront mode every node processes all agents that reached it
+         * back to back, which keeps its code and data hot at the cost of maintaining agent lists.
+         */
+        void setSchedule(BatchSchedule schedule)
+        {
+            _schedule = schedule;
+        }
+
+        /**
+         * Process agents ordered by a spatial key of their context, e.g. mortonKey() of their quantized position.
+         * Agents near each other are evaluated back to back, so conditions reading world data around the agent
+         * hit the same memory. Combined with setCoherent(), agents are ordered by key within each group.
+         * @param key Returns the key of an agent, an empty function restores index order
+         */
+        void setSpatialKey(std::function<std::uint64_t(const T&)> key)
+        {
+            _spatialKey = std::move(key);
+        }
+
+        /**
+         * Performs an iteration of the tree for every agent
+         */
+        void Update()
+        {
+            _order.clear();
+            if (_coherent)
+            {
+                for (const auto& bucket : _buckets)
+                {
+                    const std::size_t first = _order.size();
+                    _order.insert(_order.end(), bucket.second.begin(), bucket.second.end());
+                    _sort_spatial(first);
+                }
+            }
+            else
+            {
+                for (std::size_t agent = 0; agent < _agents.size(); agent++)
+                {
+                    _order.push_back(agent);
+                }
+                _sort_spatial(0);
+            }
+            const bool indexed = !_coherent && !_spatialKey;
+            _next.assign(_agents.size(), nullptr);
+
+            if (_schedule == BatchSchedule::WAVEFRONT)
+            {
+                _wavefront();
+                _regroup();
+                return;
+            }
+
+            LaneBlock<T> block;
+            block.tick = ++_ticks;
+            for (std::size_t first = 0; first < _order.size(); first += LaneBlock<T>::LANES)
+            {
+                block.count = std::min(LaneBlock<T>::LANES, _order.size() - first);
+                for (std::size_t lane = 0; lane < block.count; lane++)
+                {
+                    block.contexts[lane] = _agents[_order[first + lane]];
+                    block.running[lane] = nullptr;
+                }
+
+                const StatePlanes states = _tree->_evaluate_lanes(block, block.lanes());
+                if (indexed)
+                {
+                    // Blocks line up with the stored planes
+                    _states[first / LaneBlock<T>::LANES] = states;
+                }
+                for (std::size_t lane = 0; lane < block.count; lane++)
+                {
+                    const std::size_t agent = _order[first + lane];
+                    const NodeState state = states.state(unsigned(lane));
+                    if (!indexed) _set_state(agent, state);
+                    _next[agent] = state == NodeState::RUNNING ? block.running[lane] : nullptr;
+                }
+            }
+
+            _regroup();
+        }
+
+        /**
+         * @return Number of agents
+         */
+        std::size_t size() const { return _agents.size(); }
+
+        /**
+         * @return Context of the agent
+         */
+        T* context(std::size_t agent) const { return _agents[agent]; }
+
+        /**
+         * @return State of the tree for the agent after the last update
+         */
+        NodeState state(std::size_t agent) const
+        {
+            return _states[agent / LaneBlock<T>::LANES].state(unsigned(agent % LaneBlock<T>::LANES));
+        }
+
+        /**
+         * @return States of the tree for agents [64 * block, 64 * block + 64) after the last update
+         */
+        const StatePlanes& states(std::size_t block) const { return _states[block]; }
+
+        /**
+         * @return The node the agent was RUNNING in after the last update, nullptr if the tree did not run
+         */
+        Node<T>* runningNode(std::size_t agent) const { return _leaves[agent]; }
+
+    private:
+        Node<T>* _tree;
+        std::vector<T*> _agents;
+        std::vector<StatePlanes> _states; // Root state of every 64 agents
+
+        BatchSchedule _schedule = BatchSchedule::LANES;
+        std::uint64_t _ticks = 0; // Updates so far, numbers the lane blocks
+
+        // Agents grouped by running node
+        bool _coherent = false;
+        std::unordered_map<Node<T>*, std::vector<std::size_t>> _buckets;
+        std::vector<Node<T>*> _leaves;       // Running node of each agent
+        std::vector<std::size_t> _positions; // Position of each agent in its bucket
+        std::vector<Node<T>*> _next;         // Running node of each agent after this update
+        std::vector<std::size_t> _order;     // Agents in evaluation order
+
+        // Agents ordered by spatial key
+        std::function<std::uint64_t(const T&)> _spatialKey;
+        std::vector<std::pair<std::uint64_t, std::size_t>> _keys;
+
+        /**
+         * Sorts the agents in _order from first to the end by their spatial key
+         */
+        void _sort_spatial(std::size_t first)
+        {
+            if (!_spatialKey) return;
+            _keys.clear();
+            for (std::size_t i = first; i < _order.size(); i++)
+            {
+                _keys.emplace_back(_spatialKey(*_agents[_order[i]]), _order[i]);
+            }
+            std::sort(_keys.begin(), _keys.end());
+            for (std::size_t i = 0; i < _keys.size(); i++)
+            {
+                _order[first + i] = _keys[i].second;
+            }
+        }
+
+        void _wavefront()
+        {
+            Wavefront<T> wave = {_agents.data(), _next.data()};
+            std::vector<NodeState> states(_order.size());
+            _tree->_evaluate_wave(wave, _order, states.data());
+            for (std::size_t i = 0; i < _order.size(); i++)
+            {
+                const std::size_t agent = _order[i];
+                _set_state(agent, states[i]);
+                if (states[i] != NodeState::RUNNING) _next[agent] = nullptr;
+            }
+        }
+
+        /**
+         * Moves agents whose running node changed to their new group
+         */
+        void _regroup()
+        {
+            for (std::size_t agent = 0; agent < _agents.size(); agent++)
+            {
+                if (_next[agent] == _leaves[agent]) continue;
+                _unbucket(agent);
+                _bucket(agent, _next[agent]);
+            }
+        }
+
+        void _set_state(std::size_t agent, NodeState state)
+        {
+            StatePlanes& planes = _states[agent / LaneBlock<T>::LANES];
+            const LaneMask bit = LaneMask(1) << (agent % LaneBlock<T>::LANES);
+            planes.done &= ~bit;
+            planes.success &= ~bit;
+            planes.set(unsigned(agent % LaneBlock<T>::LANES), state);
+        }
+
+        void _bucket(std::size_t agent, Node<T>* leaf)
+        {
+            std::vector<std::size_t>& bucket = _buckets[leaf];
+            _leaves[agent] = leaf;
+            _positions[agent] = bucket.size();
+            bucket.push_back(agent);
+        }
+
+        void _unbucket(std::size_t agent)
+        {
+            std::vector<std::size_t>& bucket = _buckets[_leaves[agent]];
+            const std::size_t moved = bucket.back();
+            bucket[_positions[agent]] = moved;
+            _positions[moved] = _positions[agent];
+            bucket.pop_back();
         }
     };
 
@@ -0,0 +1,568 @@
+#ifndef BEHAVIORTREE_SYNTHETICTREE_H
+#define BEHAVIORTREE_SYNTHETICTREE_H
+
+#include "../BehaviorTree.h"
+#include <random>
+#include <sstream>
+
+/**
+ * Synthetic trees for the tools: random shapes built from scripted leaves, evaluated on fake agents.
+ *
+ * Leaves do not sleep or touch a game. Their result is a hash of (agent, tick, leaf), or for field
+ * conditions a test of the agent's id and tick, so every engine evaluating the same shape on the same
+ * agents must produce the same states.
+ */
+namespace BHT { namespace Synthetic {
+
+    /**
+     * Fake data context of an agent
+     */
+    struct Agent
+    {
+        std::uint32_t id;
+        std::uint32_t tick;     // Tick the leaves are scripted for, advanced by the caller
+        std::uint32_t work;     // Iterations of busy work each action does
+        float x, y;             // Position, for spatial ordering
+        std::uint64_t sink;     // Result of the busy work, keeps it from being optimized away
+        std::uint64_t trace;    // Hash of the leaves evaluated for the agent, in order
+        std::uint32_t classed;  // Leaves below equivalence nodes evaluated for the agent, which batch mode only
+                                // evaluates for one agent of each class
+    };
+
+    /**
+     * @return Scripted result of a leaf. Conditions only return SUCCESS or FAILURE.
+     */
+    inline NodeState script(std::uint32_t agent, std::uint32_t tick, std::uint32_t leaf, bool condition)
+    {
+        std::uint32_t hash = (agent * 2654435761u) ^ (tick * 40503u) ^ (leaf * 97u);
+        hash ^= hash >> 13;
+        hash *= 0x5bd1e995u;
+        hash ^= hash >> 15;
+        const std::uint32_t pick = hash % 3;
+        if (condition) return pick == 0 ? NodeState::SUCCESS : NodeState::FAILURE;
+        return NodeState(pick);
+    }
+
+    /**
+     * @param classes If not 0, the leaf is scripted for the agent's id modulo classes and only counted in
+     *                Agent::classed, so it is a pure function of the inputs of an equivalence class
+     */
+    class Condition : public IConditionLeaf<Agent>
+    {
+    public:
+        explicit Condition(std::uint32_t leaf, std::uint32_t classes = 0)
+            : IConditionLeaf<Agent>("C" + std::to_string(leaf)), _leaf(leaf), _classes(classes)
+        {}
+
+        bool condition() override
+        {
+            if (_classes != 0)
+            {
+                context->classed++;
+                return script(context->id % _classes, context->tick, _leaf, true) == NodeState::SUCCESS;
+            }
+            context->trace = context->trace * 31 + _leaf + 1;
+            return script(context->id, context->tick, _leaf, true) == NodeState::SUCCESS;
+        }
+
+    private:
+        std::uint32_t _leaf;
+        std::uint32_t _classes;
+    };
+
+    /**
+     * @param classes As for Condition
+     */
+    class Action : public IActionLeaf<Agent>
+    {
+    public:
+        explicit Action(std::uint32_t leaf, std::uint32_t classes = 0)
+            : IActionLeaf<Agent>("A" + std::to_string(leaf)), _leaf(leaf), _classes(classes)
+        {}
+
+        NodeState action() override
+        {
+            if (_classes != 0)
+            {
+                context->classed++;
+                return script(context->id % _classes, context->tick, _leaf, false);
+            }
+            std::uint64_t value = context->sink;
+            for (std::uint32_t i = 0; i < context->work; i++)
+            {
+                value = value * 6364136223846793005ull + 1442695040888963407ull;
+            }
+            context->sink = value;
+            context->trace = context->trace * 31 + _leaf + 1;
+            return script(context->id, context->tick, _leaf, false);
+        }
+
+    private:
+        std::uint32_t _leaf;
+        std::uint32_t _classes;
+    };
+
+    /**
+     * Action with its own action_batch, which runs the agents of a batch in reverse order
+     */
+    class BatchAction : public IActionLeaf<Agent>
+    {
+    public:
+        explicit BatchAction(std::uint32_t leaf) : IActionLeaf<Agent>("B" + std::to_string(leaf)), _leaf(leaf)
+        {}
+
+        NodeState action() override
+        {
+            return _run(*context);
+        }
+
+        void action_batch(Agent* const* contexts, std::size_t count, NodeState* states) override
+        {
+            for (std::size_t i = count; i-- > 0;)
+            {
+                states[i] = _run(*contexts[i]);
+            }
+        }
+
+    private:
+        std::uint32_t _leaf;
+
+        NodeState _run(Agent& agent) const
+        {
+            std::uint64_t value = agent.sink;
+            for (std::uint32_t i = 0; i < agent.work; i++)
+            {
+                value = value * 6364136223846793005ull + 1442695040888963407ull;
+            }
+            agent.sink = value;
+            agent.trace = agent.trace * 31 + _leaf + 1;
+            return script(agent.id, agent.tick, _leaf, false);
+        }
+    };
+
+    /**
+     * Action depending on its own state, like Wait: RUNNING unless its last state was RUNNING, else scripted.
+     * Batch mode keeps no node states, so only trees per agent and stateless trees evaluate it faithfully.
+     */
+    class Step : public Node<Agent>
+    {
+    public:
+        explicit Step(std::uint32_t leaf) : Node<Agent>(nullptr, "S" + std::to_string(leaf)), _leaf(leaf)
+        {}
+
+        NodeState _evaluate() override
+        {
+            return _run(*context, this->state);
+        }
+
+        NodeState _evaluate_instance(Agent* context, NodeState* states) override
+        {
+            this->context = context;
+            return _run(*context, states[this->index]);
+        }
+
+    private:
+        std::uint32_t _leaf;
+
+        NodeState _run(Agent& agent, NodeState last) const
+        {
+            agent.trace = agent.trace * 31 + _leaf + 1;
+            if (last != NodeState::RUNNING) return NodeState::RUNNING;
+            return script(agent.id, agent.tick, _leaf, false);
+        }
+    };
+
+    /**
+     * Classes agents by their id modulo a number of classes
+     */
+    class Classes : public IEquivalenceClasses<Agent, std::uint32_t>
+    {
+    public:
+        Classes(Node<Agent>* child, std::uint32_t classes)
+            : IEquivalenceClasses<Agent, std::uint32_t>(child, "Classes"), _classes(classes)
+        {}
+
+        std::uint32_t inputs() override
+        {
+            return context->id % _classes;
+        }
+
+    private:
+        std::uint32_t _classes;
+    };
+
+    /**
+     * Predicate of a condition group, scripted like a condition leaf with the parameter as its leaf
+     */
+    inline bool predicate(const Agent& agent, double leaf)
+    {
+        return script(agent.id, agent.tick, std::uint32_t(leaf), true) == NodeState::SUCCESS;
+    }
+
+    // Field conditions on the id and tick of an agent
+    typedef FieldCompare<&Agent::id, Less, 75u> LowId;
+    typedef FieldRange<&Agent::tick, 2u, 5u> EarlyTick;
+    typedef FieldCompare<&Agent::tick, GreaterEqual, 4u> LateTick;
+    typedef FieldAll<FieldRange<&Agent::id, 20u, 120u>, FieldCompare<&Agent::tick, NotEqual, 3u>> MiddleId;
+
+    class Selector : public ISelectorBranch<Agent>
+    {
+    public:
+        Selector() : ISelectorBranch<Agent>("Selector") {}
+    };
+
+    class Sequence : public ISequenceBranch<Agent>
+    {
+    public:
+        Sequence() : ISequenceBranch<Agent>("Sequence") {}
+    };
+
+    class ParallelSequence : public IParalellSequence<Agent>
+    {
+    public:
+        ParallelSequence() : IParalellSequence<Agent>("ParallelSequence") {}
+    };
+
+    class Parallel : public IParallel<Agent>
+    {
+    public:
+        Parallel(std::size_t successThreshold, std::size_t failureThreshold)
+            : IParallel<Agent>(successThreshold, failureThreshold, "Parallel")
+        {}
+    };
+
+    enum class Kind
+    {
+        CONDITION,
+        ACTION,
+        INVERTER,
+        SELECTOR,
+        SEQUENCE,
+        PARALLEL_SEQUENCE,
+        PARALLEL,
+        WAIT,
+        COOLDOWN,
+        TIMEOUT,
+        SUBTREE,       // Reference to a definition in a SubtreeLibrary, the only child is the definition
+        FIELD,         // Field condition, the leaf picks one of the FIELDS conditions
+        GROUP,         // Condition group of scripted predicates
+        BATCH_ACTION,  // Action with its own action_batch
+        EQUIVALENCE,   // Equivalence classes of agents by id modulo classes, above leaves scripted for the class
+        STEP           // Action depending on its own state
+    };
+
+    static constexpr std::uint32_t FIELDS = 4;
+    static constexpr std::uint32_t CLASSES = 3; // Of the agents at every equivalence node
+
+    /**
+     * Description of a tree, which can be built any number of times and shrunk
+     */
+    struct Shape
+    {
+        Kind kind;
+        std::uint32_t leaf = 0;            // Script of a leaf
+        std::size_t successThreshold = 1;  // Of a parallel, or predicates required by a group in AT_LEAST mode
+        std::size_t failureThreshold = 0;  // Of a parallel
+        std::uint32_t milliseconds = 0;    // Of a wait, cooldown or timeout
+        GroupMode mode = GroupMode::ALL;   // Of a group
+        std::uint32_t predicates = 0;      // Of a group, scripted like leaves [leaf, leaf + predicates)
+        std::uint32_t classes = 0;         // Of an equivalence node and the nodes below it, see Condition
+        std::vector<Shape> children;
+
+        /**
+         * @return Number of nodes
+         */
+        std::size_t size() const
+        {
+            std::size_t count = 1;
+            for (const Shape& child : children) count += child.size();
+            return count;
+        }
+    };
+
+    struct Options
+    {
+        unsigned depth = 4;     // Levels of branches below the root
+        unsigned children = 4;  // Maximum children of a branch
+        bool timers = false;    // Add waits, cooldowns and timeouts, which need a tree per agent
+        bool extended = false;  // Add subtree references, field conditions, condition groups, batch actions
+                                // and equivalence classes
+        bool stateful = false;  // With extended, add leaves depending on their own state, which batch mode
+                                // does not keep
+    };
+
+    namespace detail
+    {
+        struct Generator
+        {
+            std::mt19937 random;
+            const Options& options;
+            std::uint32_t leaf;
+            std::vector<Shape> definitions; // Of the subtree references so far, to be referenced again
+        };
+
+        /**
+         * @param shared Below a subtree reference, whose definition is shared
+         * @param classes Classes of the equivalence node above, 0 if none
+         */
+        inline Shape generate(Generator& generator, unsigned depth, bool shared, std::uint32_t classes)
+        {
+            std::mt19937& random = generator.random;
+            const Options& options = generator.options;
+            Shape shape;
+            shape.classes = classes;
+            // The root is always a branch, the maximum depth only has leaves.
+            // Below an equivalence node only scripted leaves and branches keep the subtree pure.
+            unsigned pick = random() % 7;
+            if (depth == 0) pick = 3 + random() % 4;
+            else if (depth >= options.depth) pick = random() % 2;
+            else if (options.timers && !shared && classes == 0 && random() % 5 == 0) pick = 7 + random() % 3;
+            // Leaves become field conditions, groups, batch actions or steps, branches subtree references
+            // or equivalence classes. Within definitions mostly references, to nest definitions, and
+            // equivalence classes in place of leaves, so they are reached more than once per tick.
+            if (options.extended && depth > 0 && classes == 0 && random() % (shared ? 2 : 4) == 0)
+            {
+                if (pick >= 2) pick = unsigned(shared || random() % 2 == 0 ? Kind::SUBTREE : Kind::EQUIVALENCE);
+                else if (shared && !generator.definitions.empty() && random() % 2 == 0) pick = unsigned(Kind::SUBTREE);
+                else if (shared && random() % 3 == 0) pick = unsigned(Kind::EQUIVALENCE);
+                else if (options.stateful && random() % 4 == 0) pick = unsigned(Kind::STEP);
+                else pick = 11 + random() % 3;
+            }
+            shape.kind = Kind(pick);
+
+            if (shape.kind == Kind::SUBTREE)
+            {
+                // Reference a definition again or define a new one, without timers as its nodes are shared.
+                // Within a definition mostly the latest one, so definitions reference an ID more than once.
+                std::vector<Shape>& definitions = generator.definitions;
+                if (!definitions.empty() && shared && random() % 4 != 0)
+                {
+                    shape.children.push_back(definitions.back());
+                }
+                else if (!definitions.empty() && random() % 2 == 0)
+                {
+                    shape.children.push_back(definitions[random() % definitions.size()]);
+                }
+                else
+                {
+                    shape.children.push_back(generate(generator, depth + 1, true, 0));
+                    generator.definitions.push_back(shape.children.back());
+                }
+                return shape;
+            }
+            if (shape.kind == Kind::EQUIVALENCE)
+            {
+                shape.classes = CLASSES;
+                shape.children.push_back(generate(generator, depth + 1, shared, shape.classes));
+                return shape;
+            }
+            if (shape.kind == Kind::FIELD)
+            {
+                shape.leaf = generator.leaf++ % FIELDS;
+                return shape;
+            }
+            if (shape.kind == Kind::GROUP)
+            {
+                shape.mode = GroupMode(random() % 3);
+                shape.predicates = 1 + random() % 4;
+                shape.successThreshold = random() % (shape.predicates + 1);
+                shape.leaf = generator.leaf;
+                generator.leaf += shape.predicates;
+                return shape;
+            }
+            if (shape.kind >= Kind::WAIT && shape.kind <= Kind::TIMEOUT)
+            {
+                shape.milliseconds = 10 * (1 + random() % 100);
+                if (shape.kind != Kind::WAIT) shape.children.push_back(generate(generator, depth + 1, shared, classes));
+                return shape;
+            }
+            if (shape.kind == Kind::CONDITION || shape.kind == Kind::ACTION || shape.kind == Kind::BATCH_ACTION
+                || shape.kind == Kind::STEP)
+            {
+                shape.leaf = generator.leaf++;
+                return shape;
+            }
+            if (shape.kind == Kind::INVERTER)
+            {
+                shape.children.push_back(generate(generator, depth + 1, shared, classes));
+                return shape;
+            }
+
+            const unsigned count = 1 + random() % std::max(1u, options.children);
+            for (unsigned i = 0; i < count; i++)
+            {
+                shape.children.push_back(generate(generator, depth + 1, shared, classes));
+            }
+            shape.successThreshold = 1 + random() % count;
+            shape.failureThreshold = random() % (count + 1);
+            return shape;
+        }
+    }
+
+    /**
+     * @return A random shape, the same for the same seed and options
+     */
+    inline Shape generate(std::uint32_t seed, const Options& options = Options())
+    {
+        detail::Generator generator = {std::mt19937(seed), options, 0, {}};
+        return detail::generate(generator, 0, false, 0);
+    }
+
+    /**
+     * @return The shape as an s-expression, e.g. (Sequence C0 (Inverter A1))
+     */
+    inline std::string describe(const Shape& shape)
+    {
+        static const char* const fields[FIELDS] = {
+            "(FieldCompare id < 75)", "(FieldRange tick 2 5)", "(FieldCompare tick >= 4)",
+            "(FieldAll (FieldRange id 20 120) (FieldCompare tick != 3))"
+        };
+        switch (shape.kind)
+        {
+            case Kind::CONDITION:
+            case Kind::ACTION:
+            {
+                // Leaves below an equivalence node are scripted for the class, e.g. C3%4
+                const std::string name = (shape.kind == Kind::CONDITION ? "C" : "A") + std::to_string(shape.leaf);
+                return shape.classes == 0 ? name : name + "%" + std::to_string(shape.classes);
+            }
+            case Kind::STEP:
+                return "S" + std::to_string(shape.leaf);
+            case Kind::BATCH_ACTION:
+                return "B" + std::to_string(shape.leaf);
+            case Kind::FIELD:
+                return fields[shape.leaf % FIELDS];
+            case Kind::WAIT:
+                return "(Wait " + std::to_string(shape.milliseconds) + "ms)";
+            default:
+                break;
+        }
+
+        std::ostringstream out;
+        if (shape.kind == Kind::GROUP)
+        {
+            if (shape.mode == GroupMode::ALL) out << "(Group all";
+            else if (shape.mode == GroupMode::ANY) out << "(Group any";
+            else out << "(Group " << shape.successThreshold << " of";
+            for (std::uint32_t i = 0; i < shape.predicates; i++) out << " P" << shape.leaf + i;
+            out << ")";
+            return out.str();
+        }
+        if (shape.kind == Kind::INVERTER) out << "(Inverter";
+        else if (shape.kind == Kind::SUBTREE) out << "(Subtree";
+        else if (shape.kind == Kind::EQUIVALENCE) out << "(Classes " << shape.classes;
+        else if (shape.kind == Kind::COOLDOWN) out << "(Cooldown " << shape.milliseconds << "ms";
+        else if (shape.kind == Kind::TIMEOUT) out << "(Timeout " << shape.milliseconds << "ms";
+        else if (shape.kind == Kind::SELECTOR) out << "(Selector";
+        else if (shape.kind == Kind::SEQUENCE) out << "(Sequence";
+        else if (shape.kind == Kind::PARALLEL_SEQUENCE) out << "(ParallelSequence";
+        else out << "(Parallel " << shape.successThreshold << "/" << shape.failureThreshold;
+        for (const Shape& child : shape.children)
+        {
+            out << " " << describe(child);
+        }
+        out << ")";
+        return out.str();
+    }
+
+    namespace detail
+    {
+        inline Node<Agent>* build(const Shape& shape, const Clock* clock, SubtreeLibrary<Agent>* library)
+        {
+            if (shape.kind >= Kind::WAIT && shape.kind <= Kind::TIMEOUT && clock == nullptr)
+            {
+                throw std::runtime_error("Synthetic tree with timers needs a clock");
+            }
+            const Clock::Duration duration = std::chrono::milliseconds(shape.milliseconds);
+            switch (shape.kind)
+            {
+                case Kind::CONDITION:
+                    return new Condition(shape.leaf, shape.classes);
+                case Kind::ACTION:
+                    return new Action(shape.leaf, shape.classes);
+                case Kind::STEP:
+                    return new Step(shape.leaf);
+                case Kind::EQUIVALENCE:
+                    return new Classes(build(shape.children.front(), clock, library), shape.classes);
+                case Kind::BATCH_ACTION:
+                    return new BatchAction(shape.leaf);
+                case Kind::INVERTER:
+                    return new Inverter<Agent>(build(shape.children.front(), clock, library));
+                case Kind::WAIT:
+                    return new Wait<Agent>(*clock, duration);
+                case Kind::COOLDOWN:
+                    return new Cooldown<Agent>(build(shape.children.front(), clock, library), *clock, duration);
+                case Kind::TIMEOUT:
+                    return new Timeout<Agent>(build(shape.children.front(), clock, library), *clock, duration);
+                case Kind::FIELD:
+                    if (shape.leaf % FIELDS == 0) return new LowId("F0");
+                    if (shape.leaf % FIELDS == 1) return new EarlyTick("F1");
+                    if (shape.leaf % FIELDS == 2) return new LateTick("F2");
+                    return new MiddleId("F3");
+                case Kind::GROUP:
+                {
+                    auto group = new ConditionGroup<Agent>(shape.mode, shape.successThreshold, "Group");
+                    for (std::uint32_t i = 0; i < shape.predicates; i++)
+                    {
+                        group->_attach_predicate(predicate, double(shape.leaf + i));
+                    }
+                    return group;
+                }
+                case Kind::SUBTREE:
+                {
+                    if (library == nullptr) throw std::runtime_error("Synthetic tree with subtrees needs a library");
+                    // Equal definitions share an ID, and so their nodes
+                    const std::string id = describe(shape.children.front());
+                    if (library->get(id) == nullptr) library->add(id, build(shape.children.front(), clock, library));
+                    return new SubtreeRef<Agent>(id, "Subtree");
+                }
+                default:
+                    break;
+            }
+
+            Node<Agent>* node;
+            if (shape.kind == Kind::SELECTOR) node = new Selector();
+            else if (shape.kind == Kind::SEQUENCE) node = new Sequence();
+            else if (shape.kind == Kind::PARALLEL_SEQUENCE) node = new ParallelSequence();
+            else node = new Parallel(shape.successThreshold, shape.failureThreshold);
+            for (const Shape& child : shape.children)
+            {
+                node->_attach(build(child, clock, library));
+            }
+            return node;
+        }
+    }
+
+    /**
+     * @param clock Time source of waits, cooldowns and timeouts. Not owned.
+     * @param library Receives the definitions of subtree references, which are resolved. Not owned,
+     *                must outlive the tree.
+     * @return A new tree of the shape, owned by the caller
+     * @throws runtime_error if the shape has timers but there is no clock, or subtrees but there is no library
+     */
+    inline Node<Agent>* build(const Shape& shape, const Clock* clock = nullptr, SubtreeLibrary<Agent>* library = nullptr)
+    {
+        Node<Agent>* tree = detail::build(shape, clock, library);
+        if (library != nullptr) library->resolve(tree);
+        return tree;
+    }
+
+    /**
+     * @return Agents with ids [0, count), spread over a square of the given size
+     */
+    inline std::vector<Agent> agents(std::size_t count, std::uint32_t work = 0, float size = 1024.0f,
+                                     std::uint32_t seed = 0)
+    {
+        std::mt19937 random(seed);
+        std::uniform_real_distribution<float> position(0.0f, size);
+        std::vector<Agent> result(count);
+        for (std::size_t i = 0; i < count; i++)
+        {
+            result[i] = Agent{std::uint32_t(i), 0, work, position(random), position(random), 0, 0, 0};
+        }
+        return result;
+    }
+
+}}
+
+#endif //BEHAVIORTREE_SYNTHETICTREE_H
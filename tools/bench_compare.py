@@ -0,0 +1,182 @@
+#!/usr/bin/env python3
+"""
+Benchmark comparison: records repeated benchmark runs as a JSON baseline and checks new runs against it.
+
+Every benchmark command prints JSON objects, one per line (e.g. loadtest --json). Each object is one
+benchmark sample; its name is built from --name fields and its value read from --metric. Names must tell
+the benchmarks apart: record fails when two commands, or two objects of one run, produce the same name.
+
+    # Record 15 runs of each command as the baseline
+    tools/bench_compare.py record baseline.json --runs 15 \\
+        --cmd "./loadtest --json --mode lanes --seconds 2" \\
+        --cmd "./loadtest --json --mode stateless --seconds 2"
+
+    # Record the candidate the same way, then compare
+    tools/bench_compare.py record candidate.json --runs 15 --cmd ...
+    tools/bench_compare.py compare baseline.json candidate.json --threshold 3
+
+Commands are run round robin, so slow drift of a noisy machine spreads over all benchmarks instead of
+biasing one. A benchmark regresses when a two sided Mann-Whitney U test rejects equal distributions
+(--alpha) and its median got worse by at least --threshold percent. The 95% confidence interval of the
+change is estimated by bootstrapping the ratio of medians. compare exits with 1 on any regression.
+"""
+
+import argparse
+import json
+import math
+import random
+import shlex
+import statistics
+import subprocess
+import sys
+
+
+def label(field, value):
+    """Part of a benchmark name: flags by their field name, other values as they are."""
+    if isinstance(value, bool):
+        return field if value else ""
+    return str(value)
+
+
+def run_suite(commands, runs, names, metric):
+    samples = {}
+    sources = {}  # Command producing each benchmark
+    for run in range(runs):
+        for command in commands:
+            produced = set()
+            output = subprocess.run(shlex.split(command), check=True, stdout=subprocess.PIPE,
+                                    universal_newlines=True).stdout
+            for line in output.splitlines():
+                line = line.strip()
+                if not line.startswith("{"):
+                    continue
+                result = json.loads(line)
+                labels = (label(field, result[field]) for field in names if field in result)
+                name = " ".join(filter(None, labels)) or command
+                # Samples of different benchmarks must not merge under one name
+                if sources.setdefault(name, command) != command or name in produced:
+                    sys.exit("benchmark name %r is ambiguous: produced by %r and %r, add fields to --name"
+                             % (name, sources[name], command))
+                produced.add(name)
+                samples.setdefault(name, []).append(float(result[metric]))
+        print("run %d/%d done" % (run + 1, runs), file=sys.stderr)
+    return samples
+
+
+def mann_whitney(a, b):
+    """Two sided p-value of the Mann-Whitney U test, normal approximation with tie correction."""
+    pooled = sorted((value, group) for group, values in ((0, a), (1, b)) for value in values)
+    ranks = [0.0] * len(pooled)
+    ties = 0.0
+    i = 0
+    while i < len(pooled):
+        j = i
+        while j + 1 < len(pooled) and pooled[j + 1][0] == pooled[i][0]:
+            j += 1
+        for k in range(i, j + 1):
+            ranks[k] = (i + j) / 2.0 + 1.0
+        count = j - i + 1
+        ties += count ** 3 - count
+        i = j + 1
+
+    n1, n2 = len(a), len(b)
+    rank_sum = sum(rank for rank, (_, group) in zip(ranks, pooled) if group == 0)
+    u = rank_sum - n1 * (n1 + 1) / 2.0
+    n = n1 + n2
+    variance = n1 * n2 / 12.0 * ((n + 1) - ties / (n * (n - 1)))
+    if variance <= 0:
+        return 1.0
+    z = (abs(u - n1 * n2 / 2.0) - 0.5) / math.sqrt(variance)
+    return min(1.0, math.erfc(max(0.0, z) / math.sqrt(2.0)))
+
+
+def bootstrap_ratio(a, b, resamples, seed):
+    """95% confidence interval of median(b) / median(a)."""
+    generator = random.Random(seed)
+    ratios = []
+    for _ in range(resamples):
+        base = statistics.median(generator.choices(a, k=len(a)))
+        new = statistics.median(generator.choices(b, k=len(b)))
+        ratios.append(new / base if base else float("inf"))
+    ratios.sort()
+    return ratios[int(0.025 * (resamples - 1))], ratios[int(0.975 * (resamples - 1))]
+
+
+def record(args):
+    samples = run_suite(args.cmd, args.runs, args.name.split(","), args.metric)
+    with open(args.output, "w") as file:
+        json.dump({"metric": args.metric, "higher_is_better": args.higher_is_better, "samples": samples},
+                  file, indent=2)
+    print("recorded %d benchmarks to %s" % (len(samples), args.output))
+    return 0
+
+
+def compare(args):
+    with open(args.baseline) as file:
+        baseline = json.load(file)
+    with open(args.candidate) as file:
+        candidate = json.load(file)
+    if baseline["metric"] != candidate["metric"]:
+        print("metric differs: %s vs %s" % (baseline["metric"], candidate["metric"]), file=sys.stderr)
+        return 2
+    sign = -1.0 if baseline.get("higher_is_better") else 1.0
+
+    regressions = 0
+    print("%-40s %12s %12s %9s %19s %8s  %s" % ("benchmark", "baseline", "candidate", "change", "95% CI", "p", ""))
+    for name in sorted(set(baseline["samples"]) | set(candidate["samples"])):
+        a = baseline["samples"].get(name)
+        b = candidate["samples"].get(name)
+        if not a or not b:
+            print("%-40s %s" % (name, "missing in " + ("baseline" if not a else "candidate")))
+            continue
+
+        base, new = statistics.median(a), statistics.median(b)
+        change = (new / base - 1.0) * 100.0 if base else 0.0
+        low, high = bootstrap_ratio(a, b, args.resamples, args.seed)
+        p = mann_whitney(a, b) if len(a) > 1 and len(b) > 1 else 1.0
+
+        # Positive worse is a slowdown for lower-is-better metrics
+        worse = sign * change
+        verdict = "ok"
+        if p < args.alpha and worse >= args.threshold:
+            verdict = "REGRESSION %.1f%%" % worse
+            regressions += 1
+        elif p < args.alpha and worse <= -args.threshold:
+            verdict = "improved %.1f%%" % -worse
+        print("%-40s %12.4g %12.4g %+8.2f%% [%+7.2f%%,%+7.2f%%] %8.4f  %s"
+              % (name, base, new, change, (low - 1.0) * 100.0, (high - 1.0) * 100.0, p, verdict))
+
+    print("FAIL: %d regressions" % regressions if regressions else "PASS")
+    return 1 if regressions else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0].strip())
+    commands = parser.add_subparsers(dest="command")
+    commands.required = True
+
+    recorder = commands.add_parser("record", help="run the benchmarks and store the samples")
+    recorder.add_argument("output", help="JSON file to write")
+    recorder.add_argument("--cmd", action="append", required=True, help="benchmark command, repeatable")
+    recorder.add_argument("--runs", type=int, default=10, help="runs of every command (default 10)")
+    recorder.add_argument("--metric", default="ns_per_agent_tick", help="field holding the value")
+    recorder.add_argument("--name", default="mode,coherent,spatial,timers,extended,agents,threads",
+                          help="comma separated fields naming a benchmark")
+    recorder.add_argument("--higher-is-better", action="store_true", help="e.g. for throughput metrics")
+    recorder.set_defaults(run=record)
+
+    comparer = commands.add_parser("compare", help="compare a candidate against a baseline")
+    comparer.add_argument("baseline")
+    comparer.add_argument("candidate")
+    comparer.add_argument("--threshold", type=float, default=3.0, help="regression in percent (default 3)")
+    comparer.add_argument("--alpha", type=float, default=0.05, help="significance level (default 0.05)")
+    comparer.add_argument("--resamples", type=int, default=2000, help="bootstrap resamples (default 2000)")
+    comparer.add_argument("--seed", type=int, default=1, help="bootstrap seed (default 1)")
+    comparer.set_defaults(run=compare)
+
+    args = parser.parse_args()
+    return args.run(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
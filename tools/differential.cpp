@@ -0,0 +1,480 @@
+/**
+ * Differential test: evaluates random synthetic trees with every execution engine and compares each tick
+ * against the reference semantics of Node<T>::eval (a BehaviorTree per agent). Reports the first divergence
+ * with a minimized reproducer: the smallest tree, agent set and tick count found that still diverge.
+ *
+ * Compared per agent and tick: the root state, the leaves evaluated (in order) and, for the stateless
+ * engine, the state of every node. Trees for the stateless engine also get leaves depending on their own
+ * state, which batch mode does not keep. Leaves below equivalence nodes are counted per class instead: the
+ * agents of a class must evaluate them at least as often as the reference does for any one of them.
+ *
+ * Build:  g++ -std=c++17 -O2 tools/differential.cpp -o differential
+ * Run:    ./differential --trees 1000
+ *
+ * Options:
+ *   --trees N      Random trees to test (default 200)
+ *   --seed N       Seed of the first tree (default 1)
+ *   --agents N     Agents per tree, more than one lane block by default (default 150)
+ *   --ticks N      Ticks per tree (default 8)
+ *   --depth N      Levels of branches in the synthetic trees (default 4)
+ *   --children N   Maximum children of a branch (default 4)
+ *   --extended B   Add subtree references, field conditions, condition groups, batch actions, equivalence
+ *                  classes and, for the stateless engine, leaves depending on their own state (default 1)
+ *   --engine NAME  Only test one engine
+ *
+ * Exits with 1 when an engine diverges.
+ */
+
+#include "SyntheticTree.h"
+
+using namespace BHT;
+using namespace BHT::Synthetic;
+
+namespace {
+
+    /**
+     * What an engine produced for an agent in a tick
+     */
+    struct Observation
+    {
+        NodeState state;
+        std::uint64_t trace;
+        std::vector<NodeState> nodes; // State of every node, by index. Empty if the engine does not keep them.
+        std::uint32_t classed;        // Not compared, batch mode evaluates equivalence classes once per class
+
+        bool operator==(const Observation& other) const
+        {
+            if (state != other.state || trace != other.trace) return false;
+            return nodes.empty() || other.nodes.empty() || nodes == other.nodes;
+        }
+    };
+
+    /**
+     * Evaluates a tree for a set of agents, tick by tick
+     */
+    class Engine
+    {
+    public:
+        explicit Engine(const std::vector<std::uint32_t>& ids)
+        {
+            for (std::uint32_t id : ids) _agents.push_back(Agent{id, 0, 0, 0.0f, 0.0f, 0, 0, 0});
+        }
+
+        virtual ~Engine() = default;
+
+        void tick(std::uint32_t tick)
+        {
+            for (Agent& agent : _agents)
+            {
+                agent.tick = tick;
+                agent.trace = 0;
+                agent.classed = 0;
+            }
+            _update();
+        }
+
+        virtual Observation observe(std::size_t agent) const = 0;
+
+    protected:
+        std::vector<Agent> _agents;
+
+        virtual void _update() = 0;
+    };
+
+    /**
+     * The reference: a tree per agent, evaluated with Node<T>::eval
+     */
+    class ScalarEngine : public Engine
+    {
+    public:
+        ScalarEngine(const Shape& shape, const std::vector<std::uint32_t>& ids) : Engine(ids)
+        {
+            for (Agent& agent : _agents)
+            {
+                Node<Agent>* root = build(shape, nullptr, &_library);
+                _roots.push_back(root);
+                _trees.emplace_back(new BehaviorTree<Agent>(&agent, root));
+                _size = _trees.back()->size();
+            }
+        }
+
+        Observation observe(std::size_t agent) const override
+        {
+            Observation observation = {_roots[agent]->state, _agents[agent].trace, std::vector<NodeState>(_size),
+                                       _agents[agent].classed};
+            _collect(_roots[agent], observation.nodes);
+            return observation;
+        }
+
+    protected:
+        void _update() override
+        {
+            for (auto& tree : _trees) tree->Update();
+        }
+
+    private:
+        SubtreeLibrary<Agent> _library; // Declared first, outlives the trees
+        std::vector<std::unique_ptr<BehaviorTree<Agent>>> _trees;
+        std::vector<Node<Agent>*> _roots;
+        std::size_t _size = 0;
+
+        static void _collect(const Node<Agent>* node, std::vector<NodeState>& states)
+        {
+            states[node->index] = node->state;
+            if (dynamic_cast<const SubtreeRef<Agent>*>(node) != nullptr)
+            {
+                // The reference's slice holds its definition's states, numbered as the stateless engine does
+                const auto slice = std::any_cast<std::vector<NodeState>>(node->_save());
+                std::copy(slice.begin(), slice.end(), states.begin() + long(node->index + 1));
+                return;
+            }
+            for (const Node<Agent>* child : node->children) _collect(child, states);
+        }
+    };
+
+    class StatelessEngine : public Engine
+    {
+    public:
+        StatelessEngine(const Shape& shape, const std::vector<std::uint32_t>& ids)
+            : Engine(ids), _tree(build(shape, nullptr, &_library)),
+              _states(ids.size(), std::vector<NodeState>(_tree.size(), NodeState::FAILURE)),
+              _results(ids.size(), NodeState::FAILURE)
+        {}
+
+        Observation observe(std::size_t agent) const override
+        {
+            return Observation{_results[agent], _agents[agent].trace, _states[agent], _agents[agent].classed};
+        }
+
+    protected:
+        void _update() override
+        {
+            for (std::size_t i = 0; i < _agents.size(); i++)
+            {
+                _results[i] = _tree.Update(&_agents[i], _states[i].data());
+            }
+        }
+
+    private:
+        SubtreeLibrary<Agent> _library; // Declared first, outlives the tree
+        BehaviorTree<Agent> _tree;
+        std::vector<std::vector<NodeState>> _states;
+        std::vector<NodeState> _results;
+    };
+
+    class PopulationEngine : public Engine
+    {
+    public:
+        PopulationEngine(const Shape& shape, const std::vector<std::uint32_t>& ids, BatchSchedule schedule,
+                         bool coherent, bool spatial)
+            : Engine(ids), _population(build(shape, nullptr, &_library))
+        {
+            _population.setSchedule(schedule);
+            _population.setCoherent(coherent);
+            if (spatial)
+            {
+                // Any key that scrambles index order will do
+                _population.setSpatialKey([](const Agent& agent) {
+                    return mortonKey(agent.id * 7919u % 61u, agent.id % 13u, 0);
+                });
+            }
+            for (Agent& agent : _agents) _population.add(&agent);
+        }
+
+        Observation observe(std::size_t agent) const override
+        {
+            return Observation{_population.state(agent), _agents[agent].trace, {}, _agents[agent].classed};
+        }
+
+    protected:
+        void _update() override
+        {
+            _population.Update();
+        }
+
+    private:
+        SubtreeLibrary<Agent> _library; // Declared first, outlives the tree
+        Population<Agent> _population;
+    };
+
+    const std::vector<std::string> engines = {
+        "stateless", "lanes", "lanes-coherent", "lanes-spatial", "wavefront", "wavefront-coherent"
+    };
+
+    std::unique_ptr<Engine> create(const std::string& name, const Shape& shape, const std::vector<std::uint32_t>& ids)
+    {
+        if (name == "stateless") return std::unique_ptr<Engine>(new StatelessEngine(shape, ids));
+        const BatchSchedule schedule = name.compare(0, 9, "wavefront") == 0 ? BatchSchedule::WAVEFRONT
+                                                                           : BatchSchedule::LANES;
+        const bool coherent = name.find("coherent") != std::string::npos;
+        const bool spatial = name.find("spatial") != std::string::npos;
+        return std::unique_ptr<Engine>(new PopulationEngine(shape, ids, schedule, coherent, spatial));
+    }
+
+    struct Divergence
+    {
+        std::uint32_t tick;
+        std::size_t agent; // Index into the agent ids
+        Observation expected;
+        Observation actual;
+    };
+
+    /**
+     * @return Whether the engine diverges from the reference within the ticks, and the first divergence
+     */
+    bool diverges(const std::string& engine, const Shape& shape, const std::vector<std::uint32_t>& ids,
+                  std::uint32_t ticks, Divergence& divergence)
+    {
+        ScalarEngine reference(shape, ids);
+        std::unique_ptr<Engine> candidate = create(engine, shape, ids);
+        for (std::uint32_t tick = 0; tick < ticks; tick++)
+        {
+            reference.tick(tick);
+            candidate->tick(tick);
+            for (std::size_t agent = 0; agent < ids.size(); agent++)
+            {
+                const Observation expected = reference.observe(agent);
+                const Observation actual = candidate->observe(agent);
+                if (!(expected == actual))
+                {
+                    divergence = Divergence{tick, agent, expected, actual};
+                    return true;
+                }
+            }
+            // Every time the reference reaches an equivalence node, some agent of the class must evaluate it
+            for (std::uint32_t c = 0; c < CLASSES; c++)
+            {
+                std::size_t most = 0;
+                std::uint32_t needed = 0;
+                std::uint32_t evaluated = 0;
+                for (std::size_t agent = 0; agent < ids.size(); agent++)
+                {
+                    if (ids[agent] % CLASSES != c) continue;
+                    const std::uint32_t classed = reference.observe(agent).classed;
+                    if (classed > needed)
+                    {
+                        most = agent;
+                        needed = classed;
+                    }
+                    evaluated += candidate->observe(agent).classed;
+                }
+                if (evaluated < needed)
+                {
+                    divergence = Divergence{tick, most, reference.observe(most), candidate->observe(most)};
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    Shape& at(Shape& shape, const std::vector<std::size_t>& path)
+    {
+        Shape* node = &shape;
+        for (std::size_t child : path) node = &node->children[child];
+        return *node;
+    }
+
+    void paths(const Shape& shape, std::vector<std::size_t>& path, std::vector<std::vector<std::size_t>>& result)
+    {
+        result.push_back(path);
+        for (std::size_t i = 0; i < shape.children.size(); i++)
+        {
+            path.push_back(i);
+            paths(shape.children[i], path, result);
+            path.pop_back();
+        }
+    }
+
+    /**
+     * @return Smaller variants of the shape: every node replaced by a child or a leaf, every child removed
+     */
+    std::vector<Shape> shrink(const Shape& shape)
+    {
+        std::vector<std::vector<std::size_t>> nodes;
+        std::vector<std::size_t> path;
+        paths(shape, path, nodes);
+
+        std::vector<Shape> result;
+        for (const auto& node : nodes)
+        {
+            const Shape& original = at(const_cast<Shape&>(shape), node);
+            for (std::size_t i = 0; i < original.children.size(); i++)
+            {
+                Shape variant = shape;
+                Shape child = original.children[i];
+                at(variant, node) = child;
+                result.push_back(variant);
+            }
+            if (original.children.size() > 1)
+            {
+                for (std::size_t i = 0; i < original.children.size(); i++)
+                {
+                    Shape variant = shape;
+                    Shape& target = at(variant, node);
+                    target.children.erase(target.children.begin() + long(i));
+                    target.successThreshold = std::min(target.successThreshold, target.children.size());
+                    target.failureThreshold = std::min(target.failureThreshold, target.children.size());
+                    result.push_back(variant);
+                }
+            }
+            if (!original.children.empty())
+            {
+                for (Kind leaf : {Kind::CONDITION, Kind::ACTION})
+                {
+                    Shape variant = shape;
+                    Shape& target = at(variant, node);
+                    target.children.clear();
+                    target.kind = leaf;
+                    result.push_back(variant);
+                }
+            }
+        }
+        return result;
+    }
+
+    /**
+     * Shrinks the shape, agents and ticks as long as the engine keeps diverging
+     */
+    void minimize(const std::string& engine, Shape& shape, std::vector<std::uint32_t>& ids, std::uint32_t& ticks,
+                  Divergence& divergence)
+    {
+        // The agent alone, else the agents up to it, since batch engines depend on its position
+        ticks = divergence.tick + 1;
+        const std::vector<std::uint32_t> single = {ids[divergence.agent]};
+        const std::vector<std::uint32_t> prefix(ids.begin(), ids.begin() + long(divergence.agent) + 1);
+        Divergence candidate;
+        if (diverges(engine, shape, single, ticks, candidate))
+        {
+            ids = single;
+            divergence = candidate;
+        }
+        else if (diverges(engine, shape, prefix, ticks, candidate))
+        {
+            ids = prefix;
+            divergence = candidate;
+        }
+
+        bool shrunk = true;
+        while (shrunk)
+        {
+            shrunk = false;
+            for (const Shape& variant : shrink(shape))
+            {
+                if (diverges(engine, variant, ids, ticks, candidate))
+                {
+                    shape = variant;
+                    divergence = candidate;
+                    ticks = divergence.tick + 1;
+                    shrunk = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    const char* name(NodeState state)
+    {
+        if (state == NodeState::SUCCESS) return "SUCCESS";
+        if (state == NodeState::RUNNING) return "RUNNING";
+        return "FAILURE";
+    }
+
+    std::string describe(const Observation& observation)
+    {
+        std::string result = std::string(name(observation.state)) + ", trace " + std::to_string(observation.trace);
+        if (observation.classed != 0) result += ", classed " + std::to_string(observation.classed);
+        if (!observation.nodes.empty())
+        {
+            result += ", nodes";
+            for (NodeState state : observation.nodes) result += std::string(" ") + name(state)[0];
+        }
+        return result;
+    }
+
+    void usageError(const std::string& message)
+    {
+        std::cerr << "differential: " << message << "\n"
+                  << "usage: differential [--trees N] [--seed N] [--agents N] [--ticks N] [--depth N]\n"
+                  << "                    [--children N] [--extended 0|1] [--engine NAME]\n";
+        std::exit(2);
+    }
+
+}
+
+int main(int argc, char** argv)
+{
+    std::uint32_t trees = 200, first = 1, ticks = 8;
+    std::size_t agents = 150;
+    Options options;
+    options.extended = true;
+    std::vector<std::string> tested = engines;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) usageError("missing value for " + arg);
+        const std::string value = argv[++i];
+        try
+        {
+            if (arg == "--trees") trees = std::uint32_t(std::stoul(value));
+            else if (arg == "--seed") first = std::uint32_t(std::stoul(value));
+            else if (arg == "--agents") agents = std::stoul(value);
+            else if (arg == "--ticks") ticks = std::uint32_t(std::stoul(value));
+            else if (arg == "--depth") options.depth = unsigned(std::stoul(value));
+            else if (arg == "--children") options.children = unsigned(std::stoul(value));
+            else if (arg == "--extended") options.extended = std::stoul(value) != 0;
+            else if (arg == "--engine")
+            {
+                if (std::find(engines.begin(), engines.end(), value) == engines.end())
+                    usageError("unknown engine " + value);
+                tested = {value};
+            }
+            else usageError("unknown option " + arg);
+        }
+        catch (const std::logic_error&)
+        {
+            usageError("invalid value for " + arg);
+        }
+    }
+
+    std::vector<std::uint32_t> ids(agents);
+    for (std::size_t i = 0; i < agents; i++) ids[i] = std::uint32_t(i);
+
+    for (std::uint32_t seed = first; seed < first + trees; seed++)
+    {
+        for (const std::string& engine : tested)
+        {
+            Options engineOptions = options;
+            engineOptions.stateful = engine == "stateless";
+            const Shape shape = generate(seed, engineOptions);
+
+            Divergence divergence;
+            if (!diverges(engine, shape, ids, ticks, divergence)) continue;
+
+            std::cout << "DIVERGENCE engine " << engine << ", tree seed " << seed << ", agent "
+                      << ids[divergence.agent] << ", tick " << divergence.tick << "\n"
+                      << "  tree     " << describe(shape) << "\n"
+                      << "  expected " << describe(divergence.expected) << "\n"
+                      << "  actual   " << describe(divergence.actual) << "\n";
+
+            Shape reduced = shape;
+            std::vector<std::uint32_t> reducedIds = ids;
+            std::uint32_t reducedTicks = ticks;
+            minimize(engine, reduced, reducedIds, reducedTicks, divergence);
+
+            std::cout << "minimized reproducer: agents 0.." << reducedIds.size() - 1 << " with ids "
+                      << reducedIds.front() << ".." << reducedIds.back() << ", agent " << reducedIds[divergence.agent]
+                      << " diverges at tick " << divergence.tick << " of ticks 0.." << reducedTicks - 1 << "\n"
+                      << "  tree     " << describe(reduced) << "\n"
+                      << "  expected " << describe(divergence.expected) << "\n"
+                      << "  actual   " << describe(divergence.actual) << "\n";
+            return 1;
+        }
+    }
+
+    std::cout << "no divergence: " << trees << " trees, " << agents << " agents, " << ticks << " ticks, engines";
+    for (const std::string& engine : tested) std::cout << " " << engine;
+    std::cout << "\n";
+    return 0;
+}
@@ -0,0 +1,430 @@
+/**
+ * Load test: ticks populations of synthetic trees for a fixed duration and reports throughput, tick latency
+ * percentiles, memory and CPU utilization. Linux only.
+ *
+ * Build:  g++ -std=c++17 -O2 -pthread tools/loadtest.cpp -o loadtest
+ * Run:    ./loadtest --mode lanes --agents 1000000 --threads 8 --seconds 10
+ *
+ * Options:
+ *   --mode scalar|stateless|lanes|wavefront  Tick mode (default lanes)
+ *                                            scalar:    a BehaviorTree per agent, Update()
+ *                                            stateless: one BehaviorTree per thread, Update(context, states)
+ *                                            lanes:     a Population per thread, 64 agents per lane block
+ *                                            wavefront: a Population per thread, BatchSchedule::WAVEFRONT
+ *   --agents N      Agents in total (default 100000)
+ *   --threads N     Worker threads, each ticking its own share of agents (default 1)
+ *   --seconds S     Duration of the measurement (default 5), in simulated time with --step
+ *   --step MS       Run on a simulated clock advanced by MS milliseconds per tick instead of wall time.
+ *                   Days of timers pass in seconds and every run ticks the same number of times.
+ *   --seed N        Seed of the synthetic tree (default 1)
+ *   --depth N       Levels of branches in the synthetic tree (default 4)
+ *   --children N    Maximum children of a branch (default 4)
+ *   --work N        Busy work iterations per action (default 0)
+ *   --coherent      Population modes: group agents by running node
+ *   --spatial       Population modes: order agents by Morton key of their position
+ *   --timers        Scalar mode: add waits, cooldowns and timeouts to the synthetic tree
+ *   --extended      Add subtree references, field conditions, condition groups and batch actions to the tree
+ *   --json          Print a single JSON object instead of text
+ */
+
+#include "SyntheticTree.h"
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <sys/resource.h>
+
+using namespace BHT;
+using namespace BHT::Synthetic;
+
+namespace {
+
+    struct Config
+    {
+        std::string mode = "lanes";
+        std::size_t agents = 100000;
+        unsigned threads = 1;
+        double seconds = 5.0;
+        double step = 0.0; // Milliseconds per tick of the simulated clock, 0 for wall time
+        std::uint32_t seed = 1;
+        Options options;
+        std::uint32_t work = 0;
+        bool coherent = false;
+        bool spatial = false;
+        bool json = false;
+    };
+
+    /**
+     * Ticks the agents of one thread
+     */
+    class Engine
+    {
+    public:
+        explicit Engine(std::vector<Agent>& agents) : _agents(agents)
+        {}
+
+        virtual ~Engine() = default;
+
+        void tick()
+        {
+            for (Agent& agent : _agents) agent.tick++;
+            _update();
+        }
+
+    protected:
+        std::vector<Agent>& _agents;
+
+        virtual void _update() = 0;
+    };
+
+    class ScalarEngine : public Engine
+    {
+    public:
+        ScalarEngine(std::vector<Agent>& agents, const Shape& shape, const Clock& clock) : Engine(agents)
+        {
+            for (Agent& agent : agents)
+            {
+                _trees.emplace_back(new BehaviorTree<Agent>(&agent, build(shape, &clock, &_library)));
+            }
+        }
+
+    protected:
+        void _update() override
+        {
+            for (auto& tree : _trees) tree->Update();
+        }
+
+    private:
+        SubtreeLibrary<Agent> _library; // Declared first, outlives the trees
+        std::vector<std::unique_ptr<BehaviorTree<Agent>>> _trees;
+    };
+
+    class StatelessEngine : public Engine
+    {
+    public:
+        StatelessEngine(std::vector<Agent>& agents, const Shape& shape)
+            : Engine(agents), _tree(build(shape, nullptr, &_library)), _states(agents.size() * _tree.size(), NodeState::FAILURE)
+        {}
+
+    protected:
+        void _update() override
+        {
+            const std::size_t size = _tree.size();
+            for (std::size_t i = 0; i < _agents.size(); i++)
+            {
+                _tree.Update(&_agents[i], &_states[i * size]);
+            }
+        }
+
+    private:
+        SubtreeLibrary<Agent> _library; // Declared first, outlives the tree
+        BehaviorTree<Agent> _tree;
+        std::vector<NodeState> _states;
+    };
+
+    class PopulationEngine : public Engine
+    {
+    public:
+        PopulationEngine(std::vector<Agent>& agents, const Shape& shape, const Config& config)
+            : Engine(agents), _population(build(shape, nullptr, &_library))
+        {
+            if (config.mode == "wavefront") _population.setSchedule(BatchSchedule::WAVEFRONT);
+            _population.setCoherent(config.coherent);
+            if (config.spatial)
+            {
+                _population.setSpatialKey([](const Agent& agent) {
+                    return mortonKey(std::uint32_t(agent.x), std::uint32_t(agent.y));
+                });
+            }
+            for (Agent& agent : agents) _population.add(&agent);
+        }
+
+    protected:
+        void _update() override
+        {
+            _population.Update();
+        }
+
+    private:
+        SubtreeLibrary<Agent> _library; // Declared first, outlives the tree
+        Population<Agent> _population;
+    };
+
+    struct Usage
+    {
+        double user;
+        double system;
+    };
+
+    Usage usage()
+    {
+        rusage self{};
+        getrusage(RUSAGE_SELF, &self);
+        return Usage{double(self.ru_utime.tv_sec) + double(self.ru_utime.tv_usec) * 1e-6,
+                     double(self.ru_stime.tv_sec) + double(self.ru_stime.tv_usec) * 1e-6};
+    }
+
+    /**
+     * @return Value of a "Key:   123 kB" line of /proc/self/status in kB, 0 if missing
+     */
+    std::size_t status(const std::string& key)
+    {
+        std::ifstream file("/proc/self/status");
+        std::string line;
+        while (std::getline(file, line))
+        {
+            if (line.compare(0, key.size() + 1, key + ":") == 0) return std::stoul(line.substr(key.size() + 1));
+        }
+        return 0;
+    }
+
+    /**
+     * Histogram of tick latencies with a fixed size, so recording does not allocate while ticking.
+     * Buckets are exact below 64 ns and 1/32 of an octave wide above, percentiles are accurate to 1.6%.
+     */
+    class Latencies
+    {
+    public:
+        void record(std::chrono::nanoseconds latency)
+        {
+            const std::uint64_t value = std::uint64_t(std::max<std::int64_t>(0, latency.count()));
+            _buckets[_bucket(value)]++;
+            _count++;
+            _max = std::max(_max, value);
+        }
+
+        void merge(const Latencies& other)
+        {
+            for (std::size_t i = 0; i < BUCKETS; i++) _buckets[i] += other._buckets[i];
+            _count += other._count;
+            _max = std::max(_max, other._max);
+        }
+
+        std::uint64_t count() const { return _count; }
+
+        /**
+         * @return Latency in milliseconds
+         */
+        double max() const { return double(_max) * 1e-6; }
+
+        /**
+         * @return Latency in milliseconds at the percentile, the middle of its bucket
+         */
+        double percentile(double p) const
+        {
+            if (_count == 0) return 0.0;
+            const std::uint64_t rank = std::max<std::uint64_t>(1, std::uint64_t(std::ceil(p / 100.0 * double(_count))));
+            std::uint64_t seen = 0;
+            for (std::size_t i = 0; i < BUCKETS; i++)
+            {
+                seen += _buckets[i];
+                if (seen >= rank) return std::min(_middle(i), double(_max)) * 1e-6;
+            }
+            return max();
+        }
+
+    private:
+        static constexpr std::size_t BUCKETS = 64 + 58 * 32;
+
+        std::array<std::uint64_t, BUCKETS> _buckets{};
+        std::uint64_t _count = 0;
+        std::uint64_t _max = 0;
+
+        static std::size_t _bucket(std::uint64_t value)
+        {
+            if (value < 64) return std::size_t(value);
+            const unsigned octave = 63 - unsigned(__builtin_clzll(value));
+            return 64 + (octave - 6) * 32 + std::size_t(value >> (octave - 5)) - 32;
+        }
+
+        static double _middle(std::size_t bucket)
+        {
+            if (bucket < 64) return double(bucket);
+            const unsigned shift = unsigned(bucket - 64) / 32 + 1;
+            const double low = double(std::uint64_t((bucket - 64) % 32 + 32) << shift);
+            return low + double(std::uint64_t(1) << shift) / 2.0;
+        }
+    };
+
+    void usageError(const std::string& message)
+    {
+        std::cerr << "loadtest: " << message << "\n"
+                  << "usage: loadtest [--mode scalar|stateless|lanes|wavefront] [--agents N] [--threads N]\n"
+                  << "                [--seconds S] [--seed N] [--depth N] [--children N] [--work N]\n"
+                  << "                [--step MS] [--coherent] [--spatial] [--timers] [--extended]\n"
+                  << "                [--json]\n";
+        std::exit(2);
+    }
+
+    Config parse(int argc, char** argv)
+    {
+        Config config;
+        for (int i = 1; i < argc; i++)
+        {
+            const std::string arg = argv[i];
+            const auto value = [&]() -> std::string {
+                if (i + 1 >= argc) usageError("missing value for " + arg);
+                return argv[++i];
+            };
+            try
+            {
+                if (arg == "--mode") config.mode = value();
+                else if (arg == "--agents") config.agents = std::stoul(value());
+                else if (arg == "--threads") config.threads = unsigned(std::stoul(value()));
+                else if (arg == "--seconds") config.seconds = std::stod(value());
+                else if (arg == "--step") config.step = std::stod(value());
+                else if (arg == "--seed") config.seed = std::uint32_t(std::stoul(value()));
+                else if (arg == "--depth") config.options.depth = unsigned(std::stoul(value()));
+                else if (arg == "--children") config.options.children = unsigned(std::stoul(value()));
+                else if (arg == "--work") config.work = std::uint32_t(std::stoul(value()));
+                else if (arg == "--coherent") config.coherent = true;
+                else if (arg == "--spatial") config.spatial = true;
+                else if (arg == "--timers") config.options.timers = true;
+                else if (arg == "--extended") config.options.extended = true;
+                else if (arg == "--json") config.json = true;
+                else usageError("unknown option " + arg);
+            }
+            catch (const std::logic_error&)
+            {
+                usageError("invalid value for " + arg);
+            }
+        }
+        if (config.mode != "scalar" && config.mode != "stateless" && config.mode != "lanes" &&
+            config.mode != "wavefront")
+        {
+            usageError("unknown mode " + config.mode);
+        }
+        if (config.threads == 0) usageError("--threads must be at least 1");
+        if (config.step < 0.0) usageError("--step must not be negative");
+        if (config.options.timers && config.mode != "scalar") usageError("--timers needs a tree per agent, --mode scalar");
+        return config;
+    }
+
+}
+
+int main(int argc, char** argv)
+{
+    const Config config = parse(argc, argv);
+    const Shape shape = generate(config.seed, config.options);
+
+    // Every thread owns its agents and engine, nothing is shared while ticking
+    const auto setupStart = std::chrono::steady_clock::now();
+    const std::vector<Agent> all = agents(config.agents, config.work, 1024.0f, config.seed);
+    std::vector<std::vector<Agent>> shares(config.threads);
+    for (std::size_t i = 0; i < all.size(); i++)
+    {
+        shares[i % config.threads].push_back(all[i]);
+    }
+    // Threads do not share simulated clocks, which are not thread safe
+    const auto step = std::chrono::duration_cast<Clock::Duration>(std::chrono::duration<double, std::milli>(config.step));
+    SteadyClock steady;
+    std::vector<SimulatedClock> simulated(config.threads, SimulatedClock(step));
+    const auto clock = [&](unsigned thread) -> const Clock& {
+        if (config.step > 0.0) return simulated[thread];
+        return steady;
+    };
+
+    std::vector<std::unique_ptr<Engine>> engines;
+    for (unsigned t = 0; t < config.threads; t++)
+    {
+        std::vector<Agent>& share = shares[t];
+        if (config.mode == "scalar") engines.emplace_back(new ScalarEngine(share, shape, clock(t)));
+        else if (config.mode == "stateless") engines.emplace_back(new StatelessEngine(share, shape));
+        else engines.emplace_back(new PopulationEngine(share, shape, config));
+    }
+    const double setup = std::chrono::duration<double>(std::chrono::steady_clock::now() - setupStart).count();
+    const std::size_t rssIdle = status("VmRSS");
+
+    // Written once by each thread after its run
+    std::vector<Latencies> latencies(config.threads);
+    std::vector<std::uint64_t> agentTicks(config.threads, 0);
+    std::atomic<bool> start{false};
+    std::vector<std::thread> workers;
+    const auto duration = std::chrono::duration_cast<Clock::Duration>(std::chrono::duration<double>(config.seconds));
+
+    for (unsigned t = 0; t < config.threads; t++)
+    {
+        workers.emplace_back([&, t]() {
+            while (!start.load(std::memory_order_acquire)) std::this_thread::yield();
+            // The run lasts the duration on the thread's clock, tick latencies are always wall time
+            const Clock& time = clock(t);
+            const Clock::Duration end = time.now() + duration;
+            Latencies latency;
+            std::uint64_t ticked = 0;
+            while (time.now() < end)
+            {
+                const auto before = steady.now();
+                engines[t]->tick();
+                latency.record(steady.now() - before);
+                ticked += shares[t].size();
+                if (config.step > 0.0) simulated[t].step();
+            }
+            latencies[t] = latency;
+            agentTicks[t] = ticked;
+        });
+    }
+
+    const Usage usageStart = usage();
+    const auto runStart = std::chrono::steady_clock::now();
+    start.store(true, std::memory_order_release);
+    for (std::thread& worker : workers) worker.join();
+    const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - runStart).count();
+    const Usage usageEnd = usage();
+
+    Latencies latency;
+    std::uint64_t total = 0;
+    for (unsigned t = 0; t < config.threads; t++)
+    {
+        latency.merge(latencies[t]);
+        total += agentTicks[t];
+    }
+
+    const double user = usageEnd.user - usageStart.user;
+    const double system = usageEnd.system - usageStart.system;
+    const double cores = std::max(1u, std::thread::hardware_concurrency());
+    const double throughput = double(total) / wall;
+    const std::size_t rss = status("VmRSS");
+    const std::size_t peak = status("VmHWM");
+
+    if (config.json)
+    {
+        std::cout << "{\"mode\": \"" << config.mode << "\", \"agents\": " << config.agents
+                  << ", \"threads\": " << config.threads << ", \"nodes\": " << shape.size()
+                  << ", \"coherent\": " << (config.coherent ? "true" : "false")
+                  << ", \"spatial\": " << (config.spatial ? "true" : "false")
+                  << ", \"timers\": " << (config.options.timers ? "true" : "false")
+                  << ", \"extended\": " << (config.options.extended ? "true" : "false") << ", \"step_ms\": " << config.step
+                  << ", \"seed\": " << config.seed << ", \"depth\": " << config.options.depth
+                  << ", \"children\": " << config.options.children << ", \"work\": " << config.work
+                  << ", \"seconds\": " << config.seconds
+                  << ", \"setup_s\": " << setup << ", \"wall_s\": " << wall
+                  << ", \"ticks\": " << latency.count() << ", \"agent_ticks\": " << total
+                  << ", \"agent_ticks_per_s\": " << throughput
+                  << ", \"ns_per_agent_tick\": " << (total ? wall * 1e9 * config.threads / double(total) : 0.0)
+                  << ", \"tick_ms\": {\"p50\": " << latency.percentile(50) << ", \"p90\": " << latency.percentile(90)
+                  << ", \"p99\": " << latency.percentile(99) << ", \"p999\": " << latency.percentile(99.9)
+                  << ", \"max\": " << latency.max() << "}"
+                  << ", \"rss_kb\": " << rss << ", \"rss_idle_kb\": " << rssIdle << ", \"rss_peak_kb\": " << peak
+                  << ", \"cpu_user_s\": " << user << ", \"cpu_system_s\": " << system
+                  << ", \"cpu_utilization\": " << (user + system) / wall / cores << "}\n";
+        return 0;
+    }
+
+    std::ostringstream simulatedNote;
+    if (config.step > 0.0) simulatedNote << " of " << config.step << " ms simulated";
+    std::cout << "mode " << config.mode << (config.coherent ? " coherent" : "") << (config.spatial ? " spatial" : "")
+              << ", " << config.agents << " agents on " << config.threads << " threads, tree of "
+              << shape.size() << " nodes\n"
+              << "setup        " << setup << " s\n"
+              << "run          " << wall << " s, " << latency.count() << " ticks"
+              << simulatedNote.str() << "\n"
+              << "throughput   " << throughput << " agent ticks/s\n"
+              << "agent tick   " << (total ? wall * 1e9 * config.threads / double(total) : 0.0) << " ns/thread\n"
+              << "tick latency p50 " << latency.percentile(50) << " ms, p90 " << latency.percentile(90)
+              << " ms, p99 " << latency.percentile(99) << " ms, p99.9 " << latency.percentile(99.9)
+              << " ms, max " << latency.max() << " ms\n"
+              << "memory       rss " << rss << " kB (" << rssIdle << " kB before ticking), peak " << peak << " kB\n"
+              << "cpu          user " << user << " s, system " << system << " s, "
+              << 100.0 * (user + system) / wall / cores << "% of " << cores << " cores\n";
+    return 0;
+}